@@ -1,6 +1,7 @@
 #include "stdio.h"
+#include "syscall.h"
 int main() {
   printf("prog no arg from disk\n");
-  while (1);
+  exit(0);
   return 0;
 }
\ No newline at end of file
@@ -6,11 +6,14 @@
 #include "io.h"
 #include "list.h"
 #include "memory.h"
+#include "pci.h"
+#include "softirq.h"
 #include "stdio-kernel.h"
 #include "stdio.h"
 #include "string.h"
 #include "sync.h"
 #include "timer.h"
+#include "tsc.h"
 
 #define reg_data(channel) (channel->port_base + 0)
 #define reg_error(channel) (channel->port_base + 1)
@@ -27,6 +30,7 @@
 #define BIT_STAT_BSY 0x80   // status busy
 #define BIT_STAT_DRDY 0x40  // status driver ready
 #define BIT_STAT_DRQ 0x8  // status data request 表示数据准备好了, 可以传输了
+#define BIT_STAT_ERR 0x1  // 上一条命令出错
 
 // device寄存器的一些位
 #define BIT_DEV_MBS 0xa0  // 7和5位固定为1
@@ -37,11 +41,39 @@
 #define CMD_IDENTIFY 0xec      // identify指令
 #define CMD_READ_SECTOR 0x20   // 读扇区指令
 #define CMD_WRITE_SECTOR 0x30  // 写扇区指令
+#define CMD_READ_DMA 0xc8      // dma读扇区指令
+#define CMD_WRITE_DMA 0xca     // dma写扇区指令
+// 48位lba的版本
+#define CMD_READ_SECTOR_EXT 0x24
+#define CMD_WRITE_SECTOR_EXT 0x34
+#define CMD_READ_DMA_EXT 0x25
+#define CMD_WRITE_DMA_EXT 0x35
+// 多扇区块模式: 每传完一块(若干扇区)发一次中断, 而不是每个扇区一次
+#define CMD_SET_MULTIPLE 0xc6
+#define CMD_READ_MULTIPLE 0xc4
+#define CMD_WRITE_MULTIPLE 0xc5
+#define CMD_READ_MULTIPLE_EXT 0x29
+#define CMD_WRITE_MULTIPLE_EXT 0x39
+
+#define LBA28_SECTORS 0x10000000  // 28位lba能访问的扇区数
+
+// 总线主控(bus master)寄存器, 每个通道8个端口
+#define reg_bm_cmd(channel) (channel->bm_base + 0)
+#define reg_bm_status(channel) (channel->bm_base + 2)
+#define reg_bm_prdt(channel) (channel->bm_base + 4)
+
+#define BIT_BM_START 0x1  // 开始传输, 清0时停止
+#define BIT_BM_READ 0x8   // 传输方向: 从硬盘读到内存
+#define BIT_BM_ERR 0x2    // 传输出错, 写1清0
+#define BIT_BM_INTR 0x4   // 硬盘发出了中断, 写1清0
+
+#define PRD_EOT 0x8000  // prd表的最后一项
+#define PRD_MAX (PG_SIZE / sizeof(struct prd))
 
-#define max_lba ((80 * 1024 * 1024 / 512) - 1)  // 调试用, 最大扇区数
 
 uint8_t channel_cnt;             // 按硬盘数计算的通道数
 struct ide_channel channels[2];  // 两个ide通道
+static uint8_t channels_done;    // 请求已完成, 等软中断唤醒等待者的通道, 每个通道一位
 
 // 记录总拓展分区的起始lba, 初始为0
 int32_t ext_lba_base = 0;
@@ -64,6 +96,13 @@ struct partition_table_entry {
     uint32_t sec_cnt;    // 本分区的扇区数目
 } __attribute__((packed));
 
+// 物理区域描述符, 描述一段物理连续且不跨64K边界的内存. byte_cnt为0表示64K
+struct prd {
+    uint32_t paddr;
+    uint16_t byte_cnt;
+    uint16_t flags;
+} __attribute__((packed));
+
 struct boot_sector {
     uint8_t other[446];  // 引导代码446B
     struct partition_table_entry partition_table[4];
@@ -78,17 +117,33 @@ static void select_disk(struct disk* hd) {
     outb(reg_dev(hd->my_channel), reg_device);
 }
 
-// 向硬盘控制器写入起始扇区地址及要读写的扇区数
-static void select_sector(struct disk* hd, uint32_t lba, uint8_t sec_cnt) {
-    ASSERT(lba <= max_lba);
+// 向硬盘控制器写入起始扇区地址及要读写的扇区数(1到256).
+// 超出28位lba的范围时用48位lba, 返回true, 此时要发EXT版本的命令
+static bool select_sector(struct disk* hd, uint32_t lba, uint32_t sec_cnt) {
     struct ide_channel* channel = hd->my_channel;
+    uint8_t reg_device =
+        BIT_DEV_MBS | BIT_DEV_LBA | (hd->dev_no == 1 ? BIT_DEV_DEV : 0);
+    if (lba + sec_cnt <= LBA28_SECTORS) {
+        outb(reg_sect_cnt(channel), sec_cnt);  // 256写成0
+        outb(reg_lba_l(channel), lba);        // 0  -  7位
+        outb(reg_lba_m(channel), lba >> 8);   // 8  - 15位
+        outb(reg_lba_h(channel), lba >> 16);  // 16 - 23位
+        outb(reg_dev(channel), reg_device | lba >> 24);
+        return false;
+    }
+    ASSERT(hd->lba48);
+    // 48位lba下这几个寄存器各是两个字节深的fifo, 先写高字节再写低字节.
+    // lba参数只有32位, 32 - 47位总是0
+    outb(reg_sect_cnt(channel), sec_cnt >> 8);
+    outb(reg_lba_l(channel), lba >> 24);  // 24 - 31位
+    outb(reg_lba_m(channel), 0);
+    outb(reg_lba_h(channel), 0);
     outb(reg_sect_cnt(channel), sec_cnt);
-    outb(reg_lba_l(channel), lba);        // 0  -  7位
-    outb(reg_lba_m(channel), lba >> 8);   // 8  - 15位
-    outb(reg_lba_h(channel), lba >> 16);  // 16 - 23位
-
-    outb(reg_dev(channel), BIT_DEV_MBS | BIT_DEV_LBA |
-                               (hd->dev_no == 1 ? BIT_DEV_DEV : 0) | lba >> 24);
+    outb(reg_lba_l(channel), lba);
+    outb(reg_lba_m(channel), lba >> 8);
+    outb(reg_lba_h(channel), lba >> 16);
+    outb(reg_dev(channel), reg_device);
+    return true;
 }
 
 // 向通道channel发送命令cmd
@@ -136,81 +191,543 @@ static bool busy_wait(struct disk* hd) {
     return false;
 }
 
-// 从硬盘读取sec_cnt个扇区到buf
-void ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
-    ASSERT(lba <= max_lba);
-    ASSERT(sec_cnt > 0);
-    lock_acquire(&hd->my_channel->lock);
+static uint32_t bio_seq;  // 下一个bio的提交序号
 
-    // 选择操作的硬盘
-    select_disk(hd);
-    uint32_t secs_op;        // 每次操作的扇区数
-    uint32_t secs_done = 0;  // 已完成的扇区数
-    while (secs_done < sec_cnt) {
-        // secs_op是每次操作的扇区数, 默认为256, 不够256就用不够的数
-        if ((secs_done + 256) <= sec_cnt) {
-            secs_op = 256;
+// 不睡眠地等硬盘退出忙状态, 返回DRQ是否置位. 用于不能睡眠的下半部
+static bool spin_wait_drq(struct ide_channel* channel) {
+    uint32_t spins = 1000000;
+    while (spins-- > 0) {
+        uint8_t status = inb(reg_alt_status(channel));
+        if (!(status & BIT_STAT_BSY)) { return status & BIT_STAT_DRQ; }
+    }
+    return false;
+}
+
+// 从这批请求的当前位置起读写sec_cnt个扇区, 可能跨多个bio.
+// 开着中断传数据, 硬盘传完这块就会发中断, 所以先移动位置再读写端口
+static void pio_xfer(struct ide_channel* channel, uint32_t sec_cnt,
+                     bool is_write) {
+    struct disk* hd = channel->batch_disk;
+    while (sec_cnt > 0) {
+        struct bio* bio = elem2entry(struct bio, tag, channel->xfer_bio);
+        uint32_t secs_op = bio->sec_cnt - channel->xfer_off;
+        if (secs_op > sec_cnt) { secs_op = sec_cnt; }
+        void* buf = (void*)((uint32_t)bio->buf + channel->xfer_off * 512);
+        sec_cnt -= secs_op;
+        channel->secs_left -= secs_op;
+        channel->xfer_off += secs_op;
+        if (channel->xfer_off == bio->sec_cnt) {
+            channel->xfer_bio = channel->xfer_bio->next;
+            channel->xfer_off = 0;
+        }
+        if (is_write) {
+            write2sector(hd, buf, secs_op);
         } else {
-            secs_op = sec_cnt - secs_done;
+            read_from_sector(hd, buf, secs_op);
+        }
+    }
+}
+
+// 硬盘每发一次中断能传的扇区数: 块模式下是一块, 否则是一个扇区
+static uint32_t pio_block(struct ide_channel* channel) {
+    uint32_t block = channel->batch_disk->multi_secs;
+    if (block == 0) { block = 1; }
+    return block < channel->secs_left ? block : channel->secs_left;
+}
+
+// 用pio下发一批读请求. 硬盘每准备好一块数据发一次中断, 由下半部读出
+static void pio_read_start(struct disk* hd, struct bio* first,
+                           uint32_t sec_cnt) {
+    // 写入待读入的扇区数和起始扇区号
+    bool ext = select_sector(hd, first->lba, sec_cnt);
+    // 把要执行的命令写入reg_cmd寄存器
+    if (hd->multi_secs != 0) {
+        cmd_out(hd->my_channel,
+                ext ? CMD_READ_MULTIPLE_EXT : CMD_READ_MULTIPLE);
+    } else {
+        cmd_out(hd->my_channel, ext ? CMD_READ_SECTOR_EXT : CMD_READ_SECTOR);
+    }
+}
+
+// 用pio下发一批写请求, 这里写入第一块, 硬盘写完一块发一次中断, 下半部再写下一块.
+// 硬盘没有准备好接收数据时返回false
+static bool pio_write_start(struct disk* hd, struct bio* first,
+                            uint32_t sec_cnt) {
+    struct ide_channel* channel = hd->my_channel;
+    // 写入待写入的扇区数和起始扇区号
+    bool ext = select_sector(hd, first->lba, sec_cnt);
+    // 执行的命令写入reg_cmd寄存器
+    if (hd->multi_secs != 0) {
+        cmd_out(channel, ext ? CMD_WRITE_MULTIPLE_EXT : CMD_WRITE_MULTIPLE);
+    } else {
+        cmd_out(channel, ext ? CMD_WRITE_SECTOR_EXT : CMD_WRITE_SECTOR);
+    }
+    // 检测硬盘状态是否可写
+    if (!spin_wait_drq(channel)) {
+        channel->expecting_intr = false;
+        return false;
+    }
+    pio_xfer(channel, pio_block(channel), true);
+    return true;
+}
+
+// pio传输中硬盘发了一次中断: 读就读出一块数据, 写就写入下一块.
+// 返回0表示整批传完, 1表示还要等下一次中断, -1表示出错
+static int32_t pio_intr(struct ide_channel* channel, bool is_write) {
+    if (channel->ata_status & BIT_STAT_ERR) { return -1; }
+    if (is_write && channel->secs_left == 0) { return 0; }  // 最后一块写完了
+    if (!spin_wait_drq(channel)) { return -1; }
+    // 写完一块总会再来一次中断, 读只有后面还有数据时才会.
+    // 下一次中断可能在pio_xfer返回前就来, 要先设置好expecting_intr
+    uint32_t block = pio_block(channel);
+    bool more = is_write || channel->secs_left > block;
+    channel->expecting_intr = more;
+    pio_xfer(channel, block, is_write);
+    return more ? 1 : 0;
+}
+
+// 为一批请求的缓冲区建立prd表, 每一项物理连续且不跨64K边界.
+// 有缓冲区不是2字节对齐或表项不够用时返回false, 由调用者改用pio
+static bool build_prdt(struct ide_channel* channel) {
+    struct prd* prd = channel->prdt;
+    uint32_t cnt = 0, last_end = 0;
+    struct list_elem* elem = channel->batch.head.next;
+    while (elem != &channel->batch.tail) {
+        struct bio* bio = elem2entry(struct bio, tag, elem);
+        if ((uint32_t)bio->buf & 1) { return false; }
+        uint32_t vaddr = (uint32_t)bio->buf;
+        uint32_t bytes = bio->sec_cnt * 512;
+        while (bytes > 0) {
+            uint32_t paddr = addr_v2p(vaddr);
+            uint32_t len = PG_SIZE - (vaddr & (PG_SIZE - 1));  // 到本页末尾
+            if (len > bytes) { len = bytes; }
+            // 紧接上一项且不在64K边界上时并入上一项, 一项因此不会超过64K
+            if (cnt > 0 && paddr == last_end && (paddr & 0xffff) != 0) {
+                prd[cnt - 1].byte_cnt += len;
+            } else {
+                if (cnt == PRD_MAX) { return false; }
+                prd[cnt].paddr = paddr;
+                prd[cnt].byte_cnt = len;
+                prd[cnt].flags = 0;
+                cnt++;
+            }
+            last_end = paddr + len;
+            vaddr += len;
+            bytes -= len;
         }
+        elem = elem->next;
+    }
+    prd[cnt - 1].flags = PRD_EOT;
+    return true;
+}
 
-        // 写入待读入的扇区数和起始扇区号
-        select_sector(hd, lba + secs_done, secs_op);
-        // 把要执行的命令写入reg_cmd寄存器
-        cmd_out(hd->my_channel, CMD_READ_SECTOR);
+// 用dma传输secs_op个扇区, 调用前要建好prd表. 传输完由中断处理程序停下控制器
+static void dma_start(struct disk* hd, uint32_t lba, uint32_t secs_op,
+                      bool is_write) {
+    struct ide_channel* channel = hd->my_channel;
+    uint8_t dir = is_write ? 0 : BIT_BM_READ;
+    outb(reg_bm_cmd(channel), dir);
+    outl(reg_bm_prdt(channel), addr_v2p((uint32_t)channel->prdt));
+    outb(reg_bm_status(channel), BIT_BM_ERR | BIT_BM_INTR);
+    bool ext = select_sector(hd, lba, secs_op);
+    channel->dma_active = true;
+    if (is_write) {
+        cmd_out(channel, ext ? CMD_WRITE_DMA_EXT : CMD_WRITE_DMA);
+    } else {
+        cmd_out(channel, ext ? CMD_READ_DMA_EXT : CMD_READ_DMA);
+    }
+    outb(reg_bm_cmd(channel), dir | BIT_BM_START);
+}
 
-        // 写入命令后, 硬盘开始执行了, 这时开始阻塞自己
-        sema_down(&hd->my_channel->disk_done);
+static bool bio_overlap(struct bio* a, struct bio* b) {
+    return a->lba < b->lba + b->sec_cnt && b->lba < a->lba + a->sec_cnt;
+}
 
-        // 醒来后执行下面代码
-        if (!busy_wait(hd)) {
-            char error[64];
-            sprintf(error, "%s read sector %d failed!!!!\n", hd->name, lba);
-            PANIC(error);
+// 队列中有更早提交, 与bio重叠且其中有写的请求时, bio还不能下发
+static bool bio_blocked(struct disk* hd, struct bio* bio) {
+    struct list_elem* elem = hd->req_queue.head.next;
+    while (elem != &hd->req_queue.tail) {
+        struct bio* r = elem2entry(struct bio, tag, elem);
+        if (r->seq < bio->seq && (r->dir == BIO_WRITE || bio->dir == BIO_WRITE) &&
+            bio_overlap(r, bio)) {
+            return true;
         }
+        elem = elem->next;
+    }
+    return false;
+}
 
-        // 把数据从硬盘的缓冲区中读出到buf中
-        read_from_sector(hd, (void*)((uint32_t)buf + secs_done * 512), secs_op);
-        secs_done += secs_op;
+// bio按lba插入队列, lba相同的按提交顺序. 要关中断调用
+static void elv_add(struct disk* hd, struct bio* bio) {
+    bio->seq = bio_seq++;
+    struct list_elem* elem = hd->req_queue.head.next;
+    while (elem != &hd->req_queue.tail) {
+        struct bio* r = elem2entry(struct bio, tag, elem);
+        if (r->lba > bio->lba) { break; }
+        elem = elem->next;
+    }
+    list_insert_before(elem, &bio->tag);
+}
+
+// C-LOOK: 取磁头之后lba最小的请求, 没有时绕回到lba最小的请求. 再把紧接在后面,
+// 方向相同的请求合并进来, 合起来不超过256个扇区. 这批请求移到batch中,
+// 返回总扇区数. 要关中断调用
+static uint32_t elv_next(struct disk* hd, struct list* batch) {
+    struct bio* first = NULL;
+    struct list_elem* elem;
+    int pass;
+    for (pass = 0; pass < 2 && first == NULL; pass++) {
+        elem = hd->req_queue.head.next;
+        while (elem != &hd->req_queue.tail) {
+            struct bio* bio = elem2entry(struct bio, tag, elem);
+            if ((pass == 1 || bio->lba >= hd->head_lba) &&
+                !bio_blocked(hd, bio)) {
+                first = bio;
+                break;
+            }
+            elem = elem->next;
+        }
+    }
+    ASSERT(first != NULL);  // 最早提交的请求总是可以下发
+
+    uint32_t sec_cnt = 0, end = first->lba;
+    elem = &first->tag;
+    while (elem != &hd->req_queue.tail) {
+        struct bio* bio = elem2entry(struct bio, tag, elem);
+        struct list_elem* next = elem->next;
+        if (bio->lba > end) { break; }
+        if (bio->lba == end && bio->dir == first->dir &&
+            bio->use_dma == first->use_dma && sec_cnt + bio->sec_cnt <= 256 &&
+            (bio == first || !bio_blocked(hd, bio))) {
+            list_remove(elem);
+            list_append(batch, elem);
+            sec_cnt += bio->sec_cnt;
+            end += bio->sec_cnt;
+        }
+        elem = next;
     }
+    hd->head_lba = end;
+    return sec_cnt;
+}
 
-    lock_release(&hd->my_channel->lock);
+// 通道上两块硬盘轮流下发, 都没有请求时返回NULL. 要关中断调用
+static struct disk* pick_disk(struct ide_channel* channel) {
+    uint8_t i;
+    for (i = 0; i < 2; i++) {
+        struct disk* hd = &channel->devices[(channel->next_dev + i) % 2];
+        if (!list_empty(&hd->req_queue)) {
+            channel->next_dev = (hd->dev_no + 1) % 2;
+            return hd;
+        }
+    }
+    return NULL;
 }
 
-// 将buf中sec_cnt扇区数据写入硬盘
-void ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
-    ASSERT(lba <= max_lba);
-    ASSERT(sec_cnt > 0);
-    lock_acquire(&hd->my_channel->lock);
+static void batch_complete(struct ide_channel* channel, int32_t error);
 
-    // 选择硬盘
+// 把通道上的这批请求作为一条命令下发. 调用者通过channel_claim占有了通道,
+// 别人不会碰这批请求和硬盘的端口, 所以不用关中断
+static void batch_issue(struct ide_channel* channel) {
+    struct disk* hd = channel->batch_disk;
+    struct bio* first = elem2entry(struct bio, tag, channel->batch.head.next);
     select_disk(hd);
+    channel->xfer_bio = channel->batch.head.next;
+    channel->xfer_off = 0;
+    channel->secs_left = channel->batch_secs;
+    channel->batch_dma = first->use_dma && build_prdt(channel);
+    if (channel->batch_dma) {
+        dma_start(hd, first->lba, channel->batch_secs, first->dir == BIO_WRITE);
+    } else if (first->dir == BIO_READ) {
+        pio_read_start(hd, first, channel->batch_secs);
+    } else if (!pio_write_start(hd, first, channel->batch_secs)) {
+        batch_complete(channel, -1);
+    }
+}
+
+// 通道空闲时按电梯算法取下一批请求放到batch中, 返回true表示调用者占有了通道,
+// 要接着用batch_issue下发. 没有请求时通道保持空闲. 要关中断调用
+static bool channel_claim(struct ide_channel* channel) {
+    if (channel->busy) { return false; }
+    struct disk* hd = pick_disk(channel);
+    if (hd == NULL) { return false; }
+    channel->busy = true;
+    channel->batch_disk = hd;
+    channel->batch_secs = elv_next(hd, &channel->batch);
+    return true;
+}
+
+// 这批请求结束, 下发下一批, 然后逐个回调. 只有改队列时关中断,
+// 读写端口和回调都开着中断
+static void batch_complete(struct ide_channel* channel, int32_t error) {
+    struct list done;
+    list_init(&done);
+    while (!list_empty(&channel->batch)) {
+        list_append(&done, list_pop(&channel->batch));
+    }
+    enum intr_status old_status = intr_disable();
+    channel->busy = false;
+    bool claimed = channel_claim(channel);
+    intr_set_status(old_status);
+    if (claimed) { batch_issue(channel); }  // 先让硬盘忙起来, 再处理回调
+    while (!list_empty(&done)) {
+        struct bio* bio = elem2entry(struct bio, tag, list_pop(&done));
+        bio->error = error;
+        bio->end_io(bio);
+    }
+}
 
-    uint32_t secs_op;
-    uint32_t secs_done = 0;
+// 硬盘中断的下半部: 检查这批请求的结果, pio读还要在这里读出数据
+static void batch_finish(struct ide_channel* channel) {
+    struct disk* hd = channel->batch_disk;
+    struct bio* first = elem2entry(struct bio, tag, channel->batch.head.next);
+    int32_t error = 0;
+    if (channel->batch_dma) {
+        if ((channel->bm_status & BIT_BM_ERR) ||
+            (channel->ata_status & BIT_STAT_ERR)) {
+            // 这块硬盘以后都用pio, 这批请求用pio重做
+            printk("%s: dma error at sector %d, fall back to pio\n",
+                   hd->name, first->lba);
+            hd->dma = false;
+            struct list_elem* elem = channel->batch.head.next;
+            while (elem != &channel->batch.tail) {
+                struct bio* bio = elem2entry(struct bio, tag, elem);
+                bio->use_dma = false;
+                elem = elem->next;
+            }
+            batch_issue(channel);
+            return;
+        }
+    } else {
+        error = pio_intr(channel, first->dir == BIO_WRITE);
+        if (error == 1) { return; }
+    }
+    batch_complete(channel, error);
+}
+
+// 提交已经填好的bio, use_dma由调用者决定
+static void bio_submit(struct bio* bio) {
+    ASSERT(bio->sec_cnt > 0 && bio->sec_cnt <= 256);
+    ASSERT((uint32_t)bio->buf >= 0xc0000000);
+    struct disk* hd = bio->hd;
+    // 超出硬盘容量的请求直接以失败结束
+    if (bio->lba >= hd->sectors || bio->sec_cnt > hd->sectors - bio->lba) {
+        bio->error = -1;
+        bio->end_io(bio);
+        return;
+    }
+    struct ide_channel* channel = hd->my_channel;
+    enum intr_status old_status = intr_disable();
+    elv_add(hd, bio);
+    bool claimed = channel_claim(channel);
+    intr_set_status(old_status);
+    if (!claimed) { return; }
+    if (old_status == INTR_ON) {
+        batch_issue(channel);
+    } else {
+        // 调用者关着中断, pio写要忙等硬盘准备好, 交给工作线程开着中断下发
+        queue_work(&channel->issue_work);
+    }
+}
+
+// 工作线程中下发bio_submit占下的那批请求
+static void channel_issue_work(void* arg) {
+    batch_issue((struct ide_channel*)arg);
+}
+
+// 提交一个异步读写请求: 从硬盘hd的lba开始读写sec_cnt个扇区, sec_cnt不超过256.
+// 立即返回, 完成后在软中断中开着中断调用bio->end_io, bio->error为0表示成功.
+// end_io不能睡眠, 要睡眠的后续工作用queue_work推到工作线程.
+// 关着中断提交时由工作线程下发.
+// 下发和完成都可能在别的进程的地址空间中进行, buf和bio都要在内核空间
+void submit_bio(struct bio* bio, struct disk* hd, uint32_t lba, void* buf,
+                uint32_t sec_cnt, enum bio_dir dir, bio_end_io* end_io) {
+    bio->hd = hd;
+    bio->lba = lba;
+    bio->buf = buf;
+    bio->sec_cnt = sec_cnt;
+    bio->dir = dir;
+    bio->end_io = end_io;
+    bio->use_dma = hd->dma;
+    bio_submit(bio);
+}
+
+// 同步读写时提交者睡在done上, 由完成回调唤醒
+struct bio_wait {
+    struct bio bio;
+    struct semaphore done;
+};
+
+static void bio_wake(struct bio* bio) {
+    struct bio_wait* wait = elem2entry(struct bio_wait, bio, bio);
+    sema_up(&wait->done);
+}
+
+// 读写sec_cnt个扇区, 按256个扇区一个bio提交, 等每个bio完成.
+// use_dma时优先用dma, 缓冲区不适合dma的用pio. 出错返回-1
+static int32_t ide_transfer(struct disk* hd, uint32_t lba, void* buf,
+                            uint32_t sec_cnt, bool is_write, bool use_dma) {
+    ASSERT(sec_cnt > 0);
+    uint32_t secs_done = 0;  // 已完成的扇区数
     while (secs_done < sec_cnt) {
-        if ((secs_done + 256) <= sec_cnt) {
-            secs_op = 256;
-        } else {
-            secs_op = sec_cnt - secs_done;
+        struct bio_wait wait;
+        struct bio* bio = &wait.bio;
+        bio->hd = hd;
+        bio->lba = lba + secs_done;
+        // 每个bio的扇区数默认为256, 不够256就用不够的数
+        bio->sec_cnt = sec_cnt - secs_done < 256 ? sec_cnt - secs_done : 256;
+        bio->buf = (void*)((uint32_t)buf + secs_done * 512);
+        bio->dir = is_write ? BIO_WRITE : BIO_READ;
+        bio->end_io = bio_wake;
+        bio->use_dma = use_dma;
+        sema_init(&wait.done, 0);
+        // 同步读写本来就要睡眠, 开着中断下发, 下发时的忙等不关中断
+        enum intr_status old_status = intr_enable();
+        bio_submit(bio);
+        sema_down(&wait.done);
+        intr_set_status(old_status);
+        if (bio->error != 0) {
+            printk("%s %s sector %d failed!!!\n", hd->name,
+                   is_write ? "write" : "read", bio->lba);
+            return -1;
+        }
+        secs_done += bio->sec_cnt;
+    }
+    return 0;
+}
+
+// 下发和完成请求时可能在别的进程中, 只有内核空间是所有进程共用的,
+// 所以buf要在内核空间, 文件系统的缓冲区都用kmalloc分配. 出错返回-1
+static int32_t ide_rw(struct disk* hd, uint32_t lba, void* buf,
+                      uint32_t sec_cnt, bool is_write) {
+    if ((uint32_t)buf < 0xc0000000) {
+        printk("ide_rw: buf 0x%x is not in kernel space\n", (uint32_t)buf);
+        return -1;
+    }
+    return ide_transfer(hd, lba, buf, sec_cnt, is_write, hd->dma);
+}
+
+// 从硬盘读取sec_cnt个扇区到buf, 成功返回0, 失败返回-1
+int32_t ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    return ide_rw(hd, lba, buf, sec_cnt, false);
+}
+
+// 将buf中sec_cnt扇区数据写入硬盘, 成功返回0, 失败返回-1
+int32_t ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    return ide_rw(hd, lba, buf, sec_cnt, true);
+}
+
+// 读一遍sec_cnt个扇区, 返回耗时, 单位微秒
+static uint32_t bench_read(struct disk* hd, void* buf, uint32_t sec_cnt,
+                           bool use_dma) {
+    uint64_t start = ktime_get();
+    ide_transfer(hd, 0, buf, sec_cnt, false, use_dma);
+    return (uint32_t)div_u64_rem(ktime_get() - start, 1000, NULL);
+}
+
+// 从第一块硬盘的开头读sec_cnt个扇区, 分别测pio和dma的耗时存入res.
+// 硬盘不支持dma时dma_us为0. 成功返回0, 参数不对, 内存不够或读盘出错返回-1
+int32_t sys_ide_bench(uint32_t sec_cnt, struct ide_bench_result* res) {
+    if (sec_cnt == 0 || sec_cnt > IDE_BENCH_MAX_SECS || res == NULL) {
+        return -1;
+    }
+    struct disk* hd = &channels[0].devices[0];
+    uint32_t pg_cnt = DIV_ROUND_UP(sec_cnt * 512, PG_SIZE);
+    void* buf = get_kernel_pages(pg_cnt);
+    if (buf == NULL) { return -1; }
+    // 先读一遍, 两种方式都从同样热的磁盘缓存读
+    if (ide_transfer(hd, 0, buf, sec_cnt, false, hd->dma) != 0) {
+        mfree_page(PF_KERNEL, buf, pg_cnt);
+        return -1;
+    }
+    res->sec_cnt = sec_cnt;
+    res->multi_secs = hd->multi_secs;
+    uint32_t intrs = hd->my_channel->intr_cnt;
+    res->pio_us = bench_read(hd, buf, sec_cnt, false);
+    res->pio_intrs = hd->my_channel->intr_cnt - intrs;
+    intrs = hd->my_channel->intr_cnt;
+    res->dma_us = hd->dma ? bench_read(hd, buf, sec_cnt, true) : 0;
+    res->dma_intrs = hd->my_channel->intr_cnt - intrs;
+    mfree_page(PF_KERNEL, buf, pg_cnt);
+    return 0;
+}
+
+// 读lba截成28位(用了28位的寄存器)和24位(丢了48位lba的高字节)的扇区,
+// 不能是刚写进lba的内容
+static uint32_t check_alias(struct disk* hd, uint32_t lba, bool use_dma,
+                            uint8_t* back, const uint8_t* pattern) {
+    uint32_t masks[2] = {LBA28_SECTORS - 1, 0xffffff};
+    uint32_t i;
+    for (i = 0; i < 2; i++) {
+        if (ide_transfer(hd, lba & masks[i], back, 1, false, use_dma) != 0) {
+            return IDE_CHECK_IO_ERROR;
+        }
+        if (memcmp(back, pattern, 512) == 0) { return IDE_CHECK_ALIASED; }
+    }
+    return IDE_CHECK_OK;
+}
+
+// 用pio或dma把各扇区写成不同的内容再读回比较, 结果存入status.
+// 还要读截断了的lba, 确认高位真的发给了硬盘. 检查完写回原来的内容
+static void check_sectors(struct disk* hd, const uint32_t* lba, bool use_dma,
+                          uint8_t* buf, uint32_t* status) {
+    uint8_t* saved = buf;
+    uint8_t* pattern = saved + IDE_CHECK_LBAS * 512;
+    uint8_t* back = pattern + IDE_CHECK_LBAS * 512;
+    bool saved_ok[IDE_CHECK_LBAS];
+    uint32_t i, j;
+    for (i = 0; i < IDE_CHECK_LBAS; i++) {
+        status[i] = IDE_CHECK_SKIPPED;
+        saved_ok[i] = false;
+        if (lba[i] >= hd->sectors) { continue; }
+        if (ide_transfer(hd, lba[i], saved + i * 512, 1, false, use_dma) != 0) {
+            status[i] = IDE_CHECK_IO_ERROR;
+            continue;
+        }
+        saved_ok[i] = true;
+        uint32_t* word = (uint32_t*)(pattern + i * 512);
+        for (j = 0; j < 512 / 4; j++) { word[j] = lba[i] ^ (j * 0x9e3779b9); }
+        status[i] = ide_transfer(hd, lba[i], word, 1, true, use_dma) == 0 ?
+                    IDE_CHECK_OK : IDE_CHECK_IO_ERROR;
+    }
+    // 全部写完再读, 两个扇区互相覆盖也能发现
+    for (i = 0; i < IDE_CHECK_LBAS; i++) {
+        if (status[i] != IDE_CHECK_OK) { continue; }
+        if (ide_transfer(hd, lba[i], back, 1, false, use_dma) != 0) {
+            status[i] = IDE_CHECK_IO_ERROR;
+        } else if (memcmp(back, pattern + i * 512, 512) != 0) {
+            status[i] = IDE_CHECK_MISMATCH;
+        } else if (lba[i] >= LBA28_SECTORS) {
+            status[i] = check_alias(hd, lba[i], use_dma, back,
+                                    pattern + i * 512);
         }
-        // 写入待写入的扇区数和起始扇区号
-        select_sector(hd, lba + secs_done, secs_op);
-        // 执行的命令写入reg_cmd寄存器
-        cmd_out(hd->my_channel, CMD_WRITE_SECTOR);
-        // 检测硬盘状态是否可读
-        if (!busy_wait(hd)) {
-            char error[64];
-            sprintf(error, "%s write sector %d failed!!!\n", hd->name, lba);
-            PANIC(error);
+    }
+    for (i = 0; i < IDE_CHECK_LBAS; i++) {
+        if (saved_ok[i] &&
+            ide_transfer(hd, lba[i], saved + i * 512, 1, true, use_dma) != 0) {
+            status[i] = IDE_CHECK_IO_ERROR;
         }
+    }
+}
 
-        // 写入硬盘
-        write2sector(hd, (void*)((uint32_t)buf + secs_done * 512), secs_op);
-        sema_down(&hd->my_channel->disk_done);
-        secs_done += secs_op;
+// 在sdc上第一个要用48位lba的扇区和最后一个扇区写入再读回, pio和dma各测一遍.
+// 没有sdc或内存不够返回-1, 否则返回0, 各扇区的结果在res中
+int32_t sys_ide_check(struct ide_check_result* res) {
+    struct disk* hd = &channels[1].devices[0];
+    if (res == NULL || channel_cnt < 2 || hd->sectors == 0) { return -1; }
+    uint8_t* buf = get_kernel_pages(1);
+    if (buf == NULL) { return -1; }
+    res->sectors = hd->sectors;
+    res->lba[0] = LBA28_SECTORS;
+    res->lba[1] = hd->sectors - 1;
+    check_sectors(hd, res->lba, false, buf, res->pio);
+    if (hd->dma) {
+        check_sectors(hd, res->lba, true, buf, res->dma);
+    } else {
+        uint32_t i;
+        for (i = 0; i < IDE_CHECK_LBAS; i++) { res->dma[i] = IDE_CHECK_SKIPPED; }
     }
-    lock_release(&hd->my_channel->lock);
+    mfree_page(PF_KERNEL, buf, 1);
+    return 0;
 }
 
 static void swap_pairs_bytes(const char* dst, char* buf, uint32_t len) {
@@ -222,6 +739,18 @@ static void swap_pairs_bytes(const char* dst, char* buf, uint32_t len) {
     buf[idx] = '\0';
 }
 
+// 设置READ/WRITE MULTIPLE每块的扇区数, 取硬盘支持的最大值. 不支持时为0
+static void set_multiple(struct disk* hd, uint8_t max_secs) {
+    hd->multi_secs = 0;
+    if (max_secs == 0) { return; }
+    struct ide_channel* channel = hd->my_channel;
+    select_disk(hd);
+    outb(reg_sect_cnt(channel), max_secs);
+    cmd_out(channel, CMD_SET_MULTIPLE);
+    sema_down(&channel->disk_done);
+    if (!(channel->ata_status & BIT_STAT_ERR)) { hd->multi_secs = max_secs; }
+}
+
 static void identify_disk(struct disk* hd) {
     char id_info[512];
     select_disk(hd);
@@ -242,9 +771,24 @@ static void identify_disk(struct disk* hd) {
     memset(buf, 0, sizeof(buf));
     swap_pairs_bytes(&id_info[md_start], buf, md_len);
     printk("    MODULE: %s\n", buf);
-    uint32_t sectors = *(uint32_t*)&id_info[60 * 2];
-    printk("    SECTORS: %d\n", sectors);
-    printk("    CAPACITY: %dMB\n", sectors * 512 / 1024 / 1024);
+    // 第49个字的第8位表示支持dma, 还要通道上有总线主控
+    hd->dma = hd->my_channel->bm_base != 0 && (id_info[49 * 2 + 1] & 0x1);
+    printk("    DMA: %s\n", hd->dma ? "yes" : "no");
+    // 第83个字的第10位表示支持48位lba, 容量在第100到103个字.
+    // 否则容量在第60和61个字. lba参数是32位的, 只用前2TB
+    hd->lba48 = id_info[83 * 2 + 1] & 0x4;
+    hd->sectors = *(uint32_t*)&id_info[60 * 2];
+    if (hd->lba48) {
+        uint32_t lba48_high = *(uint32_t*)&id_info[102 * 2];
+        hd->sectors = lba48_high != 0 ? 0xffffffff
+                                      : *(uint32_t*)&id_info[100 * 2];
+    }
+    printk("    LBA48: %s\n", hd->lba48 ? "yes" : "no");
+    // 第47个字的低字节是块模式每块最多的扇区数
+    set_multiple(hd, id_info[47 * 2]);
+    printk("    MULTIPLE: %d\n", hd->multi_secs);
+    printk("    SECTORS: 0x%x\n", hd->sectors);
+    printk("    CAPACITY: %dMB\n", hd->sectors / 2048);
 }
 
 // 扫描硬盘hd中, 地址为ext_lba的扇区中的所有分区
@@ -297,7 +841,7 @@ static bool partition_info(struct list_elem* pelem, int arg UNUSED) {
     return false;
 }
 
-// 硬盘中断处理程序
+// 硬盘中断处理程序. 只应答硬盘, 唤醒等待者推迟到软中断
 void intr_hd_handler(uint8_t irq_no) {
     // 中断向量号只有0x2e和0x2f两个
     ASSERT(irq_no == 0x2e || irq_no == 0x2f);
@@ -306,11 +850,55 @@ void intr_hd_handler(uint8_t irq_no) {
     ASSERT(channel->irq_no == irq_no);
     if (channel->expecting_intr) {
         channel->expecting_intr = false;
-        sema_up(&channel->disk_done);
-        inb(reg_status(channel));
+        channel->intr_cnt++;
+        // 读状态寄存器, 硬盘才会撤销中断
+        channel->ata_status = inb(reg_status(channel));
+        if (channel->dma_active) {
+            // 停下控制器, 清掉中断和出错位
+            channel->dma_active = false;
+            channel->bm_status = inb(reg_bm_status(channel));
+            outb(reg_bm_cmd(channel), 0);
+            outb(reg_bm_status(channel), channel->bm_status);
+        }
+        channels_done |= (1 << ch_no);
+        raise_softirq(BLOCK_SOFTIRQ);
+    }
+}
+
+// 硬盘中断的下半部, 结束通道上的这批请求并下发下一批
+static void ide_softirq() {
+    enum intr_status old_status = intr_disable();
+    uint8_t done = channels_done;
+    channels_done = 0;
+    intr_set_status(old_status);
+    uint8_t ch_no;
+    for (ch_no = 0; ch_no < channel_cnt; ch_no++) {
+        if (!(done & (1 << ch_no))) { continue; }
+        struct ide_channel* channel = &channels[ch_no];
+        // 这批请求只有下半部在处理, 开着中断读写端口和回调
+        if (channel->busy) {
+            batch_finish(channel);
+        } else {  // 初始化时identify之类不经过请求队列的命令
+            sema_up(&channel->disk_done);
+        }
     }
 }
 
+// 找pci上的ide控制器, 打开总线主控, 返回总线主控寄存器的基址. 没有时返回0
+static uint16_t bus_master_probe() {
+    struct pci_dev pdev;
+    if (!pci_find_class(0x01, 0x01, &pdev)) { return 0; }  // 大容量存储, ide
+    uint32_t class_rev = pci_read_config(&pdev, PCI_CLASS_REV);
+    if (!(class_rev & 0x8000)) { return 0; }  // 编程接口第7位: 支持总线主控
+    uint32_t bar4 = pci_read_config(&pdev, PCI_BAR4);
+    if (!(bar4 & 0x1)) { return 0; }  // 只支持io空间的寄存器
+    uint32_t cmd = pci_read_config(&pdev, PCI_COMMAND);
+    pci_write_config(&pdev, PCI_COMMAND,
+                     (cmd & 0xffff) | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+    printk("   ide bus master at 0x%x\n", bar4 & 0xfffc);
+    return bar4 & 0xfffc;
+}
+
 // 硬盘数据结构初始化
 void ide_init() {
     printk("ide_init start\n");
@@ -318,6 +906,8 @@ void ide_init() {
     printk("   ide_init hd_cnt:%d\n", hd_cnt);
     ASSERT(hd_cnt > 0);
     list_init(&partition_list);
+    open_softirq(BLOCK_SOFTIRQ, ide_softirq);
+    uint16_t bm_base = bus_master_probe();
     // 一个ide通道上有两个硬盘, 据此获取ide通道数量
     channel_cnt = DIV_ROUND_UP(hd_cnt, 2);
     struct ide_channel* channel;
@@ -341,17 +931,37 @@ void ide_init() {
         }
         // 未向硬盘写入指令时, 不用期待硬盘的中断
         channel->expecting_intr = false;
-        lock_init(&channel->lock);
-        // 初始化位0, 则发送请求后, 会被阻塞, 知道硬盘完成后通过中断,
-        // 由中断处理程序进行sema_up, 唤醒线程
+        channel->dma_active = false;
+        channel->intr_cnt = 0;
+        // 两个通道的总线主控寄存器各占8个端口, prd表不能跨64K边界, 用一整页
+        channel->bm_base = 0;
+        if (bm_base != 0) {
+            channel->prdt = get_kernel_pages(1);
+            if (channel->prdt != NULL) {
+                channel->bm_base = bm_base + channel_no * 8;
+            }
+        }
+        channel->busy = false;
+        channel->next_dev = 0;
+        list_init(&channel->batch);
+        // 初始化为0, 则发送identify后, 会被阻塞, 直到硬盘完成后通过中断,
+        // 由中断的下半部进行sema_up, 唤醒线程
         sema_init(&channel->disk_done, 0);
+        work_init(&channel->issue_work, channel_issue_work, channel);
         register_handler(channel->irq_no, intr_hd_handler);
 
         while (dev_no < 2) {
             struct disk* hd = &channel->devices[dev_no];
             hd->my_channel = channel;
             hd->dev_no = dev_no;
+            list_init(&hd->req_queue);
+            hd->head_lba = 0;
             sprintf(hd->name, "sd%c", 'a' + channel_no * 2 + dev_no);
+            // 硬盘数为奇数时最后一个通道只有主盘, 从盘的sectors为0, 请求都会失败
+            if (channel_no * 2 + dev_no >= hd_cnt) {
+                dev_no++;
+                continue;
+            }
             identify_disk(hd);
             if (dev_no != 0) { partition_scan(hd, 0); }
             p_no = 0, l_no = 0;
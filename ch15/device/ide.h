@@ -5,6 +5,7 @@
 #include "memory.h"
 #include "stdint.h"
 #include "sync.h"
+#include "workqueue.h"
 
 // 分区表
 struct partition {
@@ -17,6 +18,9 @@ struct partition {
     struct bitmap block_bitmap;  // 块位图
     struct bitmap inode_bitmap;  // inode位图
     struct list open_inodes;     // 本分区打开的inode
+    // 目录树锁. 路径查找, 读目录持读锁, 创建删除文件和目录持写锁
+    struct rwlock tree_lock;
+    struct rwlock open_inodes_lock;  // 保护open_inodes, 在tree_lock之后获取
 };
 
 // 硬盘
@@ -24,6 +28,12 @@ struct disk {
     char name[8];                    // 硬盘名
     struct ide_channel* my_channel;  // 本硬盘属于哪个ide通道
     uint8_t dev_no;                  // 本硬盘是主0, 还是从1
+    bool dma;                        // 是否用dma传输
+    bool lba48;                      // 是否支持48位lba
+    uint32_t sectors;                // identify得到的扇区数
+    uint8_t multi_secs;              // 块模式每块的扇区数, 0表示不用块模式
+    struct list req_queue;           // 按lba排序的请求队列
+    uint32_t head_lba;               // 磁头位置, 即上一条命令结束的扇区
     struct partition prim_parts[4];  // 主分区最多4个
     struct partition logic_parts[8];  // 逻辑分区数目, 理论上无限, 这里指定8个
 };
@@ -33,15 +43,81 @@ struct ide_channel {
     char name[8];                // ata通道名字
     uint16_t port_base;          // 本通道的起始端口号
     uint8_t irq_no;              // 本通道所用的中断号
-    struct lock lock;            // 通道锁
+    bool busy;                   // 有一批请求正在传输
+    uint8_t next_dev;            // 下一次优先下发哪块硬盘的请求
+    struct list batch;           // 正在传输的一批请求, 合并成了一条命令
+    struct disk* batch_disk;     // 这批请求所在的硬盘
+    uint32_t batch_secs;         // 这批请求的总扇区数
+    bool batch_dma;              // 这批请求是否用dma传输
+    struct list_elem* xfer_bio;  // pio传到了哪个bio
+    uint32_t xfer_off;           // 在这个bio中已传的扇区数
+    uint32_t secs_left;          // 这批请求还没传的扇区数
+    uint32_t intr_cnt;           // 收到的硬盘中断数
     bool expecting_intr;         // 是否在等待硬盘的中断
-    struct semaphore disk_done;  // 用于阻塞, 唤醒驱动程序
+    struct semaphore disk_done;  // 等待不经过请求队列的命令, 如identify
+    uint16_t bm_base;            // 总线主控寄存器的端口, 0表示不能用dma
+    struct prd* prdt;            // dma用的prd表, 占一页
+    bool dma_active;             // 正在进行dma传输
+    uint8_t ata_status;          // 中断时读到的硬盘状态
+    uint8_t bm_status;           // dma结束时总线主控的状态
+    struct work_struct issue_work;  // 关着中断提交时, 推到工作线程下发
     struct disk devices[2];  // 一个通道上连接两个硬盘, 一主一从
 };
 
-void ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
-void ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+enum bio_dir { BIO_READ, BIO_WRITE };
+
+struct bio;
+typedef void bio_end_io(struct bio* bio);
+
+// 一个异步读写请求, 由提交者分配, 完成回调之前不能释放.
+// 回调中可以用elem2entry从bio找到包含它的结构
+struct bio {
+    struct list_elem tag;  // 在硬盘的请求队列中, 下发时移到通道的batch中
+    struct disk* hd;
+    uint32_t lba;
+    uint32_t sec_cnt;  // 不超过256
+    void* buf;         // 内核地址
+    enum bio_dir dir;
+    bool use_dma;
+    uint32_t seq;  // 提交的先后, 有重叠的请求按它的顺序下发
+    int32_t error;  // 完成时设置, 0表示成功
+    bio_end_io* end_io;
+};
+
+#define IDE_BENCH_MAX_SECS 2048  // 测速最多读1MB
+
+// pio和dma读同样扇区数的耗时和中断数
+struct ide_bench_result {
+    uint32_t sec_cnt;
+    uint32_t multi_secs;  // pio块模式每块的扇区数, 0表示不用块模式
+    uint32_t pio_us;
+    uint32_t pio_intrs;
+    uint32_t dma_us;  // 0表示不支持dma
+    uint32_t dma_intrs;
+};
+
+#define IDE_CHECK_LBAS 2  // lba48自检的扇区数: 第一个48位lba扇区和最后一个扇区
+#define IDE_CHECK_OK 0
+#define IDE_CHECK_SKIPPED 1   // 硬盘没这么大, 或不支持dma
+#define IDE_CHECK_IO_ERROR 2
+#define IDE_CHECK_MISMATCH 3  // 读回的和写入的不一样
+#define IDE_CHECK_ALIASED 4   // 写到了截断的lba上
+
+// 在sdc上写入再读回扇区的结果, pio和dma各一组
+struct ide_check_result {
+    uint32_t sectors;  // sdc的扇区数
+    uint32_t lba[IDE_CHECK_LBAS];
+    uint32_t pio[IDE_CHECK_LBAS];
+    uint32_t dma[IDE_CHECK_LBAS];
+};
+
+void submit_bio(struct bio* bio, struct disk* hd, uint32_t lba, void* buf,
+                uint32_t sec_cnt, enum bio_dir dir, bio_end_io* end_io);
+int32_t ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+int32_t ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
 void intr_hd_handler(uint8_t irq_no);
+int32_t sys_ide_bench(uint32_t sec_cnt, struct ide_bench_result* res);
+int32_t sys_ide_check(struct ide_check_result* res);
 void ide_init();
 extern uint8_t channel_cnt;
 extern struct ide_channel channels[];
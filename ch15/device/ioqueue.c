@@ -2,6 +2,7 @@
 #include "debug.h"
 #include "global.h"
 #include "interrupt.h"
+#include "wait_exit.h"
 
 void ioqueue_init(struct ioqueue* ioq) {
     lock_init(&ioq->lock);
@@ -37,21 +38,33 @@ static void wakeup(struct task_struct** waiter) {
     *waiter = NULL;
 }
 
-char ioq_getchar(struct ioqueue* ioq) {
+// 取一个字节存入byte. 等待期间所属进程开始退出时返回false, 不再等待
+bool ioq_getchar(struct ioqueue* ioq, char* byte) {
     ASSERT(intr_get_status() == INTR_OFF);
 
     while (ioq_empty(ioq)) {
         // 队列空, 没法get. 把当前thread标记为consumer. 并加入等待队列
         lock_acquire(&ioq->lock);
-        ioq_wait(&ioq->consumer);
+        // 排在锁上的同组线程拿到锁时进程可能已经在退出了, 不要再睡
+        if (!group_exiting(running_thread())) { ioq_wait(&ioq->consumer); }
         lock_release(&ioq->lock);
+        if (group_exiting(running_thread())) { return false; }
     }
 
-    char byte = ioq->buf[ioq->tail];
+    *byte = ioq->buf[ioq->tail];
     ioq->tail = next_pos(ioq->tail);
 
     if (ioq->producer != NULL) { wakeup(&ioq->producer); }
-    return byte;
+    return true;
+}
+
+// 进程退出时唤醒它睡在ioq上的消费者, 醒来的线程在ioq_getchar中返回false
+void ioq_wake_group(struct ioqueue* ioq, struct task_struct* leader) {
+    enum intr_status old_status = intr_disable();
+    if (ioq->consumer != NULL && ioq->consumer->group_leader == leader) {
+        wakeup(&ioq->consumer);
+    }
+    intr_set_status(old_status);
 }
 
 void ioq_putchar(struct ioqueue* ioq, char byte) {
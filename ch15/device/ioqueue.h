@@ -19,7 +19,8 @@ struct ioqueue {
 void ioqueue_init(struct ioqueue* ioq);
 bool ioq_full(struct ioqueue* ioq);
 bool ioq_empty(struct ioqueue* ioq);
-char ioq_getchar(struct ioqueue* ioq);
+bool ioq_getchar(struct ioqueue* ioq, char* byte);
 void ioq_putchar(struct ioqueue* ioq, char byte);
+void ioq_wake_group(struct ioqueue* ioq, struct task_struct* leader);
 
 #endif
\ No newline at end of file
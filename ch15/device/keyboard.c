@@ -4,8 +4,10 @@
 #include "io.h"
 #include "ioqueue.h"
 #include "print.h"
+#include "softirq.h"
 
 #define KBD_BUF_PORT 0x60  // 键盘buffer寄存器端口号
+#define KBD_SCANCODE_BUF 32  // 待解码的扫描码个数, 2的幂
 
 // 用转义字符定义部分控制字符
 #define esc '\033'
@@ -106,13 +108,17 @@ static char keymap[][2] = {
 static bool ctrl_status, shift_status, alt_status, caps_lock_status,
     ext_scancode;
 
-static void intr_keyboard_handler() {
+// 中断处理程序读出的扫描码, 由软中断解码. 关中断访问
+static uint8_t scancode_buf[KBD_SCANCODE_BUF];
+static uint32_t scancode_head, scancode_tail;
+
+// 把一个扫描码解码成字符放入kbd_buf. 只在软中断中执行, 开着中断
+static void keyboard_decode(uint16_t scancode) {
     bool ctrl_down_last = ctrl_status;
     bool shift_down_last = shift_status;
     bool caps_lock_last = caps_lock_status;
 
     bool break_code;
-    uint16_t scancode = inb(KBD_BUF_PORT);
 
     // 扫描码以e0开头, 说明按下的按键会产生多个扫描码. 立即结束此次中断, 等待下一个扫描码
     if (scancode == 0xe0) {
@@ -168,9 +174,11 @@ static void intr_keyboard_handler() {
         uint8_t index = (scancode &= 0x00ff);
         char cur_char = keymap[index][shift];
         if (cur_char) {
+            enum intr_status old_status = intr_disable();
             if (!ioq_full(&kbd_buf)) {
                 ioq_putchar(&kbd_buf, cur_char);
             }
+            intr_set_status(old_status);
             return;
         }
 
@@ -188,9 +196,35 @@ static void intr_keyboard_handler() {
     }
 }
 
+// 键盘中断的下半部
+static void keyboard_softirq() {
+    while (true) {
+        enum intr_status old_status = intr_disable();
+        if (scancode_tail == scancode_head) {
+            intr_set_status(old_status);
+            break;
+        }
+        uint8_t scancode = scancode_buf[scancode_tail % KBD_SCANCODE_BUF];
+        scancode_tail++;
+        intr_set_status(old_status);
+        keyboard_decode(scancode);
+    }
+}
+
+// 键盘中断处理程序, 只读出扫描码, 解码推迟到软中断. 来不及处理的扫描码丢掉
+static void intr_keyboard_handler() {
+    uint8_t scancode = inb(KBD_BUF_PORT);
+    if (scancode_head - scancode_tail < KBD_SCANCODE_BUF) {
+        scancode_buf[scancode_head % KBD_SCANCODE_BUF] = scancode;
+        scancode_head++;
+    }
+    raise_softirq(KBD_SOFTIRQ);
+}
+
 void keyboard_init() {
     put_str("keyboard init start\n");
     ioqueue_init(&kbd_buf);
+    open_softirq(KBD_SOFTIRQ, keyboard_softirq);
     register_handler(0x21, intr_keyboard_handler);
     put_str("keyboard init done\n");
 }
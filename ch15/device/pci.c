@@ -0,0 +1,49 @@
+#include "pci.h"
+#include "io.h"
+
+// 配置机制1: 先往地址端口写要访问的寄存器, 再从数据端口读写
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+static uint32_t config_addr(struct pci_dev* pdev, uint8_t offset) {
+    return 0x80000000 | (pdev->bus << 16) | (pdev->dev << 11) |
+           (pdev->func << 8) | (offset & 0xfc);
+}
+
+// 读配置空间中offset处的双字, offset按4字节对齐
+uint32_t pci_read_config(struct pci_dev* pdev, uint8_t offset) {
+    outl(PCI_CONFIG_ADDR, config_addr(pdev, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+void pci_write_config(struct pci_dev* pdev, uint8_t offset, uint32_t val) {
+    outl(PCI_CONFIG_ADDR, config_addr(pdev, offset));
+    outl(PCI_CONFIG_DATA, val);
+}
+
+// 在总线0上找第一个类别为class, 子类别为subclass的功能, 找到时存入pdev.
+// qemu和bochs的设备都在总线0上, 不扫描桥后面的总线
+bool pci_find_class(uint8_t class, uint8_t subclass, struct pci_dev* pdev) {
+    pdev->bus = 0;
+    for (pdev->dev = 0; pdev->dev < 32; pdev->dev++) {
+        uint8_t func_cnt = 1;
+        for (pdev->func = 0; pdev->func < func_cnt; pdev->func++) {
+            uint32_t id = pci_read_config(pdev, 0);
+            if ((id & 0xffff) == 0xffff) {  // 没有这个功能
+                if (pdev->func == 0) { break; }
+                continue;
+            }
+            // 单功能设备可能不看功能号, 在功能1~7上读到的还是功能0, 不能扫描
+            if (pdev->func == 0 &&
+                (pci_read_config(pdev, PCI_HEADER) & PCI_HEADER_MULTI_FUNC)) {
+                func_cnt = 8;
+            }
+            uint32_t class_rev = pci_read_config(pdev, PCI_CLASS_REV);
+            if ((class_rev >> 24) == class &&
+                ((class_rev >> 16) & 0xff) == subclass) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,29 @@
+#ifndef __DEVICE_PCI_H
+#define __DEVICE_PCI_H
+
+#include "global.h"
+#include "stdint.h"
+
+// 配置空间中的寄存器偏移
+#define PCI_COMMAND 0x04    // 命令寄存器, 16位
+#define PCI_CLASS_REV 0x08  // 高24位是类别, 子类别和编程接口
+#define PCI_HEADER 0x0c     // 第16~23位是头类型
+#define PCI_BAR4 0x20
+
+#define PCI_COMMAND_IO 0x1      // 允许访问io空间
+#define PCI_COMMAND_MASTER 0x4  // 允许设备做总线主控(DMA)
+
+#define PCI_HEADER_MULTI_FUNC (1 << 23)  // 头类型的第7位: 多功能设备
+
+// 总线号, 设备号和功能号, 确定一个pci功能
+struct pci_dev {
+    uint8_t bus;
+    uint8_t dev;
+    uint8_t func;
+};
+
+uint32_t pci_read_config(struct pci_dev* pdev, uint8_t offset);
+void pci_write_config(struct pci_dev* pdev, uint8_t offset, uint32_t val);
+bool pci_find_class(uint8_t class, uint8_t subclass, struct pci_dev* pdev);
+
+#endif
@@ -3,20 +3,31 @@
 #include "interrupt.h"
 #include "io.h"
 #include "print.h"
+#include "sched.h"
 #include "thread.h"
+#include "vdso.h"
 
-#define IRQ0_FREQUENCY 100
 #define INPUT_FREQUENCY 1193180
-#define COUNTER0_VALUE INPUT_FREQUENCY / IRQ0_FREQUENCY
+#define COUNTER0_VALUE (INPUT_FREQUENCY / IRQ0_FREQUENCY)
 #define COUNTER0_PORT 0x40
 #define COUNTER0_NO 0
-#define COUNTER_MODE 2
+#define COUNTER_MODE 2          // 周期模式(rate generator)
+#define COUNTER_MODE_ONESHOT 0  // 计数到0时中断一次
 #define READ_WRITE_LATCH 3
 #define PIT_CONTROL_PORT 0x43  // 0x43是控制字寄存器的位置
-#define mil_seconds_per_intr (1000 / IRQ0_FREQUENCY)
 
 uint32_t ticks;
 
+// 只剩一个可运行任务(包括idle)时停掉周期时钟, 把PIT设成单次模式,
+// 到下一个定时器到期时才中断. 16位计数器最多能跨这么多个tick
+#define NOHZ_MAX_TICKS (0xffff / COUNTER0_VALUE)
+static uint32_t nohz_ticks;  // 单次模式覆盖的tick数, 0表示处于周期模式
+static uint16_t nohz_count;  // 单次模式写入的计数值
+
+// 挂起的定时器组成以expires为key的小根堆, 堆顶是最早到期的
+static struct timer* timer_heap[MAX_TIMERS];
+static uint32_t timer_cnt;
+
 static void frequency_set(uint8_t counter_port,
                           uint8_t counter_no,
                           uint8_t rw1,
@@ -25,26 +36,198 @@ static void frequency_set(uint8_t counter_port,
     outb(PIT_CONTROL_PORT,
          (uint8_t)(counter_no << 6 | rw1 << 4 | counter_mode << 1));
     outb(counter_port, (uint8_t)counter_value);
-    outb(counter_port, (uint8_t)counter_value >> 8);
+    outb(counter_port, (uint8_t)(counter_value >> 8));
+}
+
+// 锁存并读出计数器0的当前值
+static uint16_t pit_read_count() {
+    outb(PIT_CONTROL_PORT, (uint8_t)(COUNTER0_NO << 6));
+    uint8_t lo = inb(COUNTER0_PORT);
+    uint8_t hi = inb(COUNTER0_PORT);
+    return (uint16_t)(hi << 8 | lo);
+}
+
+static void pit_set_periodic() {
+    frequency_set(COUNTER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, COUNTER_MODE,
+                  COUNTER0_VALUE);
+}
+
+static void pit_set_oneshot(uint32_t nr_ticks, uint16_t count) {
+    frequency_set(COUNTER0_PORT, COUNTER0_NO, READ_WRITE_LATCH,
+                  COUNTER_MODE_ONESHOT, count);
+    nohz_ticks = nr_ticks;
+    nohz_count = count;
+}
+
+static void timer_heap_set(uint32_t idx, struct timer* ptimer) {
+    timer_heap[idx] = ptimer;
+    ptimer->heap_idx = idx;
+}
+
+static void timer_sift_up(uint32_t idx) {
+    struct timer* ptimer = timer_heap[idx];
+    while (idx > 0) {
+        uint32_t parent = (idx - 1) / 2;
+        if (!time_before(ptimer->expires, timer_heap[parent]->expires)) {
+            break;
+        }
+        timer_heap_set(idx, timer_heap[parent]);
+        idx = parent;
+    }
+    timer_heap_set(idx, ptimer);
+}
+
+static void timer_sift_down(uint32_t idx) {
+    struct timer* ptimer = timer_heap[idx];
+    while (true) {
+        uint32_t child = idx * 2 + 1;
+        if (child >= timer_cnt) { break; }
+        if (child + 1 < timer_cnt &&
+            time_before(timer_heap[child + 1]->expires,
+                        timer_heap[child]->expires)) {
+            child++;
+        }
+        if (!time_before(timer_heap[child]->expires, ptimer->expires)) {
+            break;
+        }
+        timer_heap_set(idx, timer_heap[child]);
+        idx = child;
+    }
+    timer_heap_set(idx, ptimer);
+}
+
+// 初始化定时器, 此时还没有挂起
+void timer_setup(struct timer* ptimer, void (*func)(void*), void* arg) {
+    ptimer->expires = 0;
+    ptimer->func = func;
+    ptimer->arg = arg;
+    ptimer->heap_idx = -1;
+}
+
+// 挂起定时器, 在第expires个tick到期
+void timer_add(struct timer* ptimer, uint32_t expires) {
+    enum intr_status old_status = intr_disable();
+    ASSERT(ptimer->heap_idx == -1);
+    if (timer_cnt >= MAX_TIMERS) { PANIC("timer_add: too many timers"); }
+    tick_nohz_exit();  // 新定时器可能早于单次模式的到期时间
+    ptimer->expires = expires;
+    timer_heap_set(timer_cnt, ptimer);
+    timer_cnt++;
+    timer_sift_up(timer_cnt - 1);
+    intr_set_status(old_status);
+}
+
+// 取消定时器, 若定时器还挂着返回true, 已经到期或没有挂起返回false
+bool timer_del(struct timer* ptimer) {
+    enum intr_status old_status = intr_disable();
+    if (ptimer->heap_idx == -1) {
+        intr_set_status(old_status);
+        return false;
+    }
+    uint32_t idx = ptimer->heap_idx;
+    ASSERT(idx < timer_cnt && timer_heap[idx] == ptimer);
+    timer_cnt--;
+    if (idx != timer_cnt) {  // 用最后一个定时器填补空位, 再调整
+        struct timer* last = timer_heap[timer_cnt];
+        timer_heap_set(idx, last);
+        timer_sift_up(idx);
+        timer_sift_down(last->heap_idx);
+    }
+    ptimer->heap_idx = -1;
+    intr_set_status(old_status);
+    return true;
+}
+
+// 执行所有已经到期的定时器
+static void run_timers() {
+    while (timer_cnt > 0 && !time_before(ticks, timer_heap[0]->expires)) {
+        struct timer* ptimer = timer_heap[0];
+        timer_del(ptimer);
+        ptimer->func(ptimer->arg);
+    }
+}
+
+// 就绪队列为空时停掉周期时钟. 只有一个任务时时间片用完也还是它, 所以只需
+// 在下一个定时器到期时醒来
+static void tick_nohz_enter() {
+    if (!sched_ready_empty() || sched_need_resched()) { return; }
+    uint32_t nr_ticks = NOHZ_MAX_TICKS;
+    if (timer_cnt > 0) {
+        int32_t delta = timer_heap[0]->expires - ticks;
+        if (delta < (int32_t)nr_ticks) { nr_ticks = delta; }
+    }
+    if (nr_ticks <= 1) { return; }
+    pit_set_oneshot(nr_ticks, nr_ticks * COUNTER0_VALUE);
+}
+
+// 有任务变为就绪或者添加了定时器时调用, 结束单次模式.
+// 补上已经过去的整tick, 再把PIT设到当前tick结束时中断, 之后恢复周期模式,
+// 这样tick的相位不变, 时间不会漂移
+void tick_nohz_exit() {
+    enum intr_status old_status = intr_disable();
+    if (nohz_ticks <= 1) {  // 不在单次模式, 或者本来就在当前tick结束时中断
+        intr_set_status(old_status);
+        return;
+    }
+    uint16_t left = pit_read_count();
+    if (left == 0 || left > nohz_count) {  // 已经到期, 中断还没处理
+        intr_set_status(old_status);
+        return;
+    }
+    uint32_t passed = nohz_count - left;
+    uint32_t done = passed / COUNTER0_VALUE;
+    pit_set_oneshot(1, COUNTER0_VALUE - passed % COUNTER0_VALUE);
+
+    struct task_struct* cur_thread = running_thread();
+    while (done-- > 0) {
+        ticks++;
+        // 这段时间只有cur_thread在运行, 所以只需记账, 是否调度留给下一个tick
+        sched_tick(cur_thread);
+    }
+    intr_set_status(old_status);
 }
 
 static void intr_timer_handler() {
     struct task_struct* cur_thread = running_thread();
     ASSERT(cur_thread->stack_magic == 0x19870916);
 
-    cur_thread->elapsed_ticks++;
-    ticks++;
-    if (cur_thread->ticks == 0) {  // 时间片用完, 调度
-        schedule();
+    uint32_t nr_ticks = 1;
+    if (nohz_ticks > 0) {  // 单次模式到期, 补上跳过的tick并恢复周期模式
+        nr_ticks = nohz_ticks;
+        nohz_ticks = 0;
+        pit_set_periodic();
+    }
+
+    bool resched = false;
+    while (nr_ticks-- > 0) {
+        ticks++;
+        run_timers();  // 先唤醒到期的睡眠任务, 它们可能需要抢占当前任务
+        // 时间片用完, 有实时任务就绪, 或者有vruntime明显更小的任务, 调度
+        if (sched_tick(cur_thread)) { resched = true; }
+    }
+    vdso_update();
+    // 不能在这里直接调度: 时钟中断可能打断了软中断, 换下去的任务会带走软中断的状态
+    if (resched) {
+        sched_set_need_resched();
     } else {
-        cur_thread->ticks--;
+        tick_nohz_enter();
     }
 }
 
-// 以tick为单位的sleep
-static void ticks_to_sleep(uint32_t sleep_ticks) {
-    uint32_t start_tick = ticks;
-    while (ticks - start_tick < sleep_ticks) { thread_yield(); }
+static void sleep_timeout(void* arg) {
+    thread_unblock((struct task_struct*)arg);
+}
+
+// 以tick为单位的sleep. 睡眠期间任务是阻塞的, 不在就绪队列里, 由定时器唤醒
+void ticks_to_sleep(uint32_t sleep_ticks) {
+    ASSERT(sleep_ticks <= SLEEP_MAX_TICKS);
+    struct timer sleep_timer;
+    timer_setup(&sleep_timer, sleep_timeout, running_thread());
+    enum intr_status old_status = intr_disable();
+    tick_nohz_exit();  // 先把跳过的tick补上, ticks才是准的
+    timer_add(&sleep_timer, ticks + sleep_ticks);
+    thread_block(TASK_BLOCKED);
+    intr_set_status(old_status);
 }
 
 // 以毫秒为单位, sleep
@@ -54,12 +237,27 @@ void mtime_sleep(uint32_t m_seconds) {
     ticks_to_sleep(sleep_ticks);
 }
 
+// 睡眠req指定的时间. 没有信号, 睡眠不会被打断, 所以rem总是0
+int32_t sys_nanosleep(const struct timespec* req, struct timespec* rem) {
+    if (req == NULL || req->tv_nsec >= NSEC_PER_SEC) { return -1; }
+    // 太长的睡眠截断到SLEEP_MAX_TICKS以内, 否则乘法溢出或超出time_before
+    // 能比较的范围, 会立刻醒来
+    uint32_t max_sec = SLEEP_MAX_TICKS / IRQ0_FREQUENCY - 1;
+    uint32_t sec = req->tv_sec < max_sec ? req->tv_sec : max_sec;
+    uint32_t sleep_ticks =
+        sec * IRQ0_FREQUENCY + DIV_ROUND_UP(req->tv_nsec, NSEC_PER_TICK);
+    if (sleep_ticks > 0) { ticks_to_sleep(sleep_ticks); }
+    if (rem != NULL) { rem->tv_sec = rem->tv_nsec = 0; }
+    return 0;
+}
+
 // 初始化PIT8253
 void timer_init() {
     put_str("timer_init start\n");
-    frequency_set(COUNTER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, COUNTER_MODE,
-                  COUNTER0_VALUE);
+    pit_set_periodic();
 
+    timer_cnt = 0;
+    nohz_ticks = 0;
     register_handler(0x20, intr_timer_handler);
     put_str("timer_init done\n");
 }
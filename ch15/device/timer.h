@@ -1,9 +1,51 @@
 #ifndef __DEVICE_TIMER_H
 #define __DEVICE_TIMER_H
 
+#include "global.h"
 #include "stdint.h"
 
+#define IRQ0_FREQUENCY 100
+#define mil_seconds_per_intr (1000 / IRQ0_FREQUENCY)
+#define NSEC_PER_SEC 1000000000
+#define NSEC_PER_TICK (NSEC_PER_SEC / IRQ0_FREQUENCY)
+
+#define MAX_TIMERS 1024  // 同时挂起的定时器上限
+
+// ticks是32位的, 会回绕, 用有符号的差值比较先后
+#define time_before(a, b) ((int32_t)((a) - (b)) < 0)
+#define time_after(a, b) time_before(b, a)
+// 到期时间最多比ticks晚这么多, 再大time_before就会判断反
+#define SLEEP_MAX_TICKS 0x7fffffff
+
+// 内核定时器, 到期后在时钟中断中调用func(arg), 此时中断是关闭的
+struct timer {
+    uint32_t expires;        // 到期的tick
+    void (*func)(void* arg);
+    void* arg;
+    int32_t heap_idx;  // 在定时器堆中的下标, -1表示没有挂起
+};
+
+struct timespec {
+    uint32_t tv_sec;
+    uint32_t tv_nsec;
+};
+
+// clock_gettime的clock_id, 取值与linux一致
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+#define CLOCK_PROCESS_CPUTIME_ID 2
+#define CLOCK_THREAD_CPUTIME_ID 3
+#define CLOCK_MONOTONIC_COARSE 6  // 精度为一个tick, 用户态读vdso即可
+
+extern uint32_t ticks;
+
+void timer_setup(struct timer* ptimer, void (*func)(void*), void* arg);
+void timer_add(struct timer* ptimer, uint32_t expires);
+bool timer_del(struct timer* ptimer);
+void tick_nohz_exit(void);
+void ticks_to_sleep(uint32_t sleep_ticks);
 void mtime_sleep(uint32_t m_seconds);
+int32_t sys_nanosleep(const struct timespec* req, struct timespec* rem);
 void timer_init();
 
-#endif
\ No newline at end of file
+#endif
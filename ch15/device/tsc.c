@@ -0,0 +1,110 @@
+#include "tsc.h"
+#include "debug.h"
+#include "global.h"
+#include "interrupt.h"
+#include "io.h"
+#include "print.h"
+#include "thread.h"
+#include "vdso.h"
+
+// 用PIT的2号计数器校准TSC. 2号计数器的gate和输出都接在0x61端口上,
+// 不会产生中断, 可以在关中断时轮询
+#define PIT_INPUT_FREQUENCY 1193180
+#define PIT_CONTROL_PORT 0x43
+#define COUNTER2_PORT 0x42
+#define PIT_CH2_GATE_PORT 0x61
+#define CH2_GATE 0x01     // bit0: 2号计数器的gate
+#define SPEAKER_DATA 0x02 // bit1: 喇叭, 校准时关掉
+#define CH2_OUT 0x20      // bit5: 2号计数器的输出
+
+#define CALIBRATE_MS 50  // 16位计数器最多计55ms左右
+#define CALIBRATE_COUNT (PIT_INPUT_FREQUENCY * CALIBRATE_MS / 1000)
+
+uint32_t tsc_khz;  // TSC频率, 单位khz
+
+// ns = cycles * tsc_mult >> tsc_shift, 避免每次换算都做除法
+uint32_t tsc_mult;
+uint32_t tsc_shift;
+uint64_t tsc_boot;  // 校准完成时的TSC, 作为单调时钟的起点
+
+// 用2号计数器的模式0计CALIBRATE_MS毫秒, 数这段时间里TSC走了多少
+static uint32_t calibrate_tsc() {
+    uint8_t gate = inb(PIT_CH2_GATE_PORT);
+    outb(PIT_CH2_GATE_PORT, (gate & ~SPEAKER_DATA) & ~CH2_GATE);
+    // 2号计数器, 先低后高读写, 模式0
+    outb(PIT_CONTROL_PORT, (uint8_t)(2 << 6 | 3 << 4 | 0 << 1));
+    outb(COUNTER2_PORT, (uint8_t)CALIBRATE_COUNT);
+    outb(COUNTER2_PORT, (uint8_t)(CALIBRATE_COUNT >> 8));
+
+    // gate拉高后开始计数, 数到0时输出变为高电平
+    outb(PIT_CH2_GATE_PORT, ((gate & ~SPEAKER_DATA) | CH2_GATE));
+    uint64_t start = rdtsc();
+    while ((inb(PIT_CH2_GATE_PORT) & CH2_OUT) == 0) {}
+    uint64_t end = rdtsc();
+
+    outb(PIT_CH2_GATE_PORT, gate);
+    return (uint32_t)(end - start) / CALIBRATE_MS;
+}
+
+// 把TSC的周期数换算成纳秒
+uint64_t cycles_to_ns(uint64_t cycles) {
+    return mul_u64_u32_shr(cycles, tsc_mult, tsc_shift);
+}
+
+// 开机以来的纳秒数, 单调递增
+uint64_t ktime_get() {
+    return cycles_to_ns(rdtsc() - tsc_boot);
+}
+
+void ns_to_timespec(uint64_t ns, struct timespec* ts) {
+    uint32_t nsec;
+    ts->tv_sec = (uint32_t)div_u64_rem(ns, NSEC_PER_SEC, &nsec);
+    ts->tv_nsec = nsec;
+}
+
+// 读取clock_id对应的时钟. 还没有读CMOS, CLOCK_REALTIME暂不支持
+int32_t sys_clock_gettime(int32_t clock_id, struct timespec* ts) {
+    if (ts == NULL) { return -1; }
+    switch (clock_id) {
+        case CLOCK_MONOTONIC:
+            ns_to_timespec(ktime_get(), ts);
+            return 0;
+        case CLOCK_MONOTONIC_COARSE:
+            ns_to_timespec(vdso_coarse_ns(), ts);
+            return 0;
+        case CLOCK_PROCESS_CPUTIME_ID:
+            ns_to_timespec(cycles_to_ns(thread_group_cpu_cycles(
+                               running_thread()->group_leader)),
+                           ts);
+            return 0;
+        case CLOCK_THREAD_CPUTIME_ID:
+            ns_to_timespec(cycles_to_ns(thread_cpu_cycles(running_thread())),
+                           ts);
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+void tsc_init() {
+    put_str("tsc_init start\n");
+    enum intr_status old_status = intr_disable();
+    tsc_khz = calibrate_tsc();
+    ASSERT(tsc_khz > 0);
+
+    // 在tsc_mult不溢出的前提下, tsc_shift尽量大, 精度最高
+    tsc_shift = 32;
+    uint64_t mult;
+    while (true) {
+        mult = div_u64_rem((uint64_t)1000000 << tsc_shift, tsc_khz, NULL);
+        if ((mult >> 32) == 0) { break; }
+        tsc_shift--;
+    }
+    tsc_mult = (uint32_t)mult;
+    tsc_boot = rdtsc();
+    intr_set_status(old_status);
+
+    put_str("   tsc khz: ");
+    put_int(tsc_khz);
+    put_str("\ntsc_init done\n");
+}
@@ -0,0 +1,50 @@
+#ifndef __DEVICE_TSC_H
+#define __DEVICE_TSC_H
+
+#include "stdint.h"
+#include "timer.h"
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return (uint64_t)hi << 32 | lo;
+}
+
+// 64位除以32位. 没有链接libgcc, 不能直接对uint64_t做除法(会调用__udivdi3),
+// 所以分高低两次用divl
+static inline uint64_t div_u64_rem(uint64_t dividend,
+                                   uint32_t divisor,
+                                   uint32_t* remainder) {
+    uint32_t hi = (uint32_t)(dividend >> 32);
+    uint32_t lo = (uint32_t)dividend;
+    uint32_t q_hi = hi / divisor;
+    uint32_t q_lo, rem;
+    hi %= divisor;  // 保证divl的商不会溢出
+    asm("divl %4" : "=a"(q_lo), "=d"(rem) : "a"(lo), "d"(hi), "rm"(divisor));
+    if (remainder != NULL) { *remainder = rem; }
+    return (uint64_t)q_hi << 32 | q_lo;
+}
+
+// 计算a * mul >> shift. a按高低32位分别乘, 不需要128位乘法
+static inline uint64_t mul_u64_u32_shr(uint64_t a,
+                                       uint32_t mul,
+                                       uint32_t shift) {
+    uint32_t lo = (uint32_t)a;
+    uint32_t hi = (uint32_t)(a >> 32);
+    uint64_t ret = ((uint64_t)lo * mul) >> shift;
+    ret += ((uint64_t)hi * mul) << (32 - shift);
+    return ret;
+}
+
+extern uint32_t tsc_khz;
+extern uint32_t tsc_mult;
+extern uint32_t tsc_shift;
+extern uint64_t tsc_boot;
+
+uint64_t cycles_to_ns(uint64_t cycles);
+uint64_t ktime_get(void);
+void ns_to_timespec(uint64_t ns, struct timespec* ts);
+int32_t sys_clock_gettime(int32_t clock_id, struct timespec* ts);
+void tsc_init(void);
+
+#endif
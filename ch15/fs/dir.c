@@ -21,7 +21,7 @@ void open_root_dir(struct partition* part) {
 
 // 打开分区part上inode_no号节点
 struct dir* dir_open(struct partition* part, uint32_t inode_no) {
-    struct dir* pdir = (struct dir*)sys_malloc(sizeof(struct dir));
+    struct dir* pdir = (struct dir*)kmalloc(sizeof(struct dir));
     pdir->inode = inode_open(part, inode_no);
     pdir->dir_pos = 0;
     return pdir;
@@ -35,9 +35,9 @@ bool search_dir_entry(struct partition* part,
                       struct dir_entry* dir_e) {
     uint32_t block_cnt = 140;  // 12个直接块, 一个一级间接块(128), 加起来140块
     // 每个块的地址4字节, 4 * 140 = 560
-    uint32_t* all_blocks = (uint32_t*)sys_malloc(560);
+    uint32_t* all_blocks = (uint32_t*)kmalloc(560);
     if (all_blocks == NULL) {
-        printk("search_dir_entry: sys_malloc for all_blocks failed");
+        printk("search_dir_entry: kmalloc for all_blocks failed");
         return false;
     }
     uint32_t block_idx = 0;
@@ -54,7 +54,7 @@ bool search_dir_entry(struct partition* part,
     }
 
     // 读目录项
-    uint8_t* buf = (uint8_t*)sys_malloc(SECTOR_SIZE);
+    uint8_t* buf = (uint8_t*)kmalloc(SECTOR_SIZE);
     struct dir_entry* p_de = (struct dir_entry*)buf;
     uint32_t dir_entry_size = part->sb->dir_entry_size;
     uint32_t dir_entry_cnt =
@@ -395,7 +395,7 @@ int32_t dir_remove(struct dir* parent_dir, struct dir* child_dir) {
         ASSERT(child_dir_inode->i_sectors[block_idx] == 0);
         block_idx++;
     }
-    void* io_buf = sys_malloc(SECTOR_SIZE * 2);
+    void* io_buf = kmalloc(SECTOR_SIZE * 2);
     if (io_buf == NULL) {
         printk("dir_remove: malloc for io_buf failed\n");
         return -1;
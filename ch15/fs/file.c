@@ -32,13 +32,14 @@ int32_t get_free_slot_in_global() {
 
 // 将全局描述符下标安装到线程自己的文件描述符数组中, 成功返回下标, 失败返回-1
 int32_t pcb_fd_install(int32_t global_fd_idx) {
-    struct task_struct* cur = running_thread();
+    struct task_struct* cur = running_thread()->group_leader;
     uint8_t local_fd_idx = 3;
     while (local_fd_idx < MAX_FILES_OPEN_PER_PROC) {
         if (cur->fd_table[local_fd_idx] == -1) {
             cur->fd_table[local_fd_idx] = global_fd_idx;
             break;
         }
+        local_fd_idx++;
     }
     if (local_fd_idx == MAX_FILES_OPEN_PER_PROC) {
         printk("exceed max open files_per_proc\n");
@@ -106,9 +107,9 @@ static int32_t rollback(uint8_t rollback_step, void* io_buf, int32_t inode_no, s
 // 创建文件, 指定filename, 父目录为parent_dir, flag可以控制是否覆盖等操作
 int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
     // 子函数经常需要一块内存来存inode 或者dir等数据结构, 这里分配一次, 避免多次分配回收
-    void* io_buf = sys_malloc(1024);
+    void* io_buf = kmalloc(1024);
     if (io_buf == NULL) {
-        printk("in file_create: sys_malloc for io_buf failed\n");
+        printk("in file_create: kmalloc for io_buf failed\n");
         return -1;
     }
 
@@ -120,9 +121,9 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
         printk("in file_create: allocate inode failed\n");
         return -1;
     }
-    struct inode* new_file_inode = (struct inode*)sys_malloc(sizeof(struct inode));
+    struct inode* new_file_inode = (struct inode*)kmalloc(sizeof(struct inode));
     if (new_file_inode == NULL) {
-        printk("file_create: sys_malloc for inode failed\n");
+        printk("file_create: kmalloc for inode failed\n");
         rollback_step = 1;
         return rollback(rollback_step, io_buf, inode_no, NULL, 0);
     }
@@ -138,6 +139,7 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
     file_table[fd_idx].fd_inode = new_file_inode;
     file_table[fd_idx].fd_pos = 0;
     file_table[fd_idx].fd_flag = flag;
+    file_table[fd_idx].fd_refs = 1;
     file_table[fd_idx].fd_inode->write_deny = false;
 
     struct dir_entry new_dir_entry;
@@ -161,8 +163,10 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
     bitmap_sync(cur_part, inode_no, INODE_BITMAP);
 
     // 新创文件添加到open_inodes链表
+    rwlock_write_acquire(&cur_part->open_inodes_lock);
     list_push(&cur_part->open_inodes, &new_file_inode->inode_tag);
     new_file_inode->i_open_cnts = 1;
+    rwlock_write_release(&cur_part->open_inodes_lock);
 
     sys_free(io_buf);
     return pcb_fd_install(fd_idx);
@@ -179,6 +183,7 @@ int32_t file_open(uint32_t inode_no, uint8_t flag) {
     file_table[fd_idx].fd_inode = inode_open(cur_part, inode_no);
     file_table[fd_idx].fd_pos = 0;
     file_table[fd_idx].fd_flag = flag;
+    file_table[fd_idx].fd_refs = 1;
     bool* write_deny = &file_table[fd_idx].fd_inode->write_deny;
 
     if (flag & O_WRONLY || flag & O_RDWR) {
@@ -200,6 +205,10 @@ int32_t file_close(struct file* file) {
     if (file == NULL) {
         return -1;
     }
+    // 还有别的进程在用, 只减引用
+    if (--file->fd_refs > 0) {
+        return 0;
+    }
     file->fd_inode->write_deny = false;
     inode_close(file->fd_inode);
     file->fd_inode = NULL;
@@ -215,14 +224,14 @@ int32_t file_write(struct file* file, const void* buf, uint32_t count)
         printk("exceed max file_size 71680 bytes, write file failed\n");
         return -1;
     }
-    uint8_t *io_buf = sys_malloc(BLOCK_SIZE);
+    uint8_t *io_buf = kmalloc(BLOCK_SIZE);
     if (io_buf == NULL) {
-        printk("file_write: sys_malloc for io_buf failed\n");
+        printk("file_write: kmalloc for io_buf failed\n");
         return -1;
     }
-    uint32_t* all_blocks = (uint32_t*)sys_malloc(BLOCK_SIZE + 48); // 用来记录文件所有的块地址
+    uint32_t* all_blocks = (uint32_t*)kmalloc(BLOCK_SIZE + 48); // 用来记录文件所有的块地址
     if (all_blocks == NULL) {
-        printk("file_write: sys_malloc for all_blocks failed\n");
+        printk("file_write: kmalloc for all_blocks failed\n");
         return -1;
     }
 
@@ -421,13 +430,13 @@ int32_t file_read(struct file* file, void* buf, uint32_t count) {
         }
     }
 
-    uint8_t* io_buf = sys_malloc(BLOCK_SIZE);
+    uint8_t* io_buf = kmalloc(BLOCK_SIZE);
     if (io_buf == NULL) {
-        printk("file_read: sys_malloc for io_buf failed\n");
+        printk("file_read: kmalloc for io_buf failed\n");
     }
-    uint32_t *all_blocks = (uint32_t *)sys_malloc(BLOCK_SIZE + 48); // 用来记录文件所有的块地址
+    uint32_t *all_blocks = (uint32_t *)kmalloc(BLOCK_SIZE + 48); // 用来记录文件所有的块地址
     if (all_blocks == NULL) {
-        printk("file_read: sys_malloc for all_blocks failed\n");
+        printk("file_read: kmalloc for all_blocks failed\n");
         return -1;
     }
 
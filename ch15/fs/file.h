@@ -12,6 +12,7 @@ struct file {
     uint32_t fd_pos;
     uint32_t fd_flag;
     struct inode* fd_inode;
+    uint32_t fd_refs;  // 引用这一项的进程数, fork出的子进程与父进程共用同一项
 };
 
 enum std_fd {
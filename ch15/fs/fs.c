@@ -26,10 +26,10 @@ static bool mount_partition(struct list_elem* pelem, int arg) {
         struct disk* hd = cur_part->my_disk;
         // sb_buf用来存储从硬盘读下来的超级块
         struct super_block* sb_buf =
-            (struct super_block*)sys_malloc(SECTOR_SIZE);
+            (struct super_block*)kmalloc(SECTOR_SIZE);
         // 在内存中创建cur_part的超级块
         cur_part->sb =
-            (struct super_block*)sys_malloc(sizeof(struct super_block));
+            (struct super_block*)kmalloc(sizeof(struct super_block));
         if (cur_part->sb == NULL) { PANIC("alloc memory failed!"); }
 
         // 读入超级块
@@ -39,7 +39,7 @@ static bool mount_partition(struct list_elem* pelem, int arg) {
         // 把sb_buf中的超级块存到cur_part->sb中
         memcpy(cur_part->sb, sb_buf, sizeof(struct super_block));
 
-        cur_part->block_bitmap.bits = (uint8_t*)sys_malloc(
+        cur_part->block_bitmap.bits = (uint8_t*)kmalloc(
             sb_buf->block_bitmap_sects *
             SECTOR_SIZE);  // 申请当前分区的block bitmap空间
         if (cur_part->block_bitmap.bits == NULL) {
@@ -50,7 +50,7 @@ static bool mount_partition(struct list_elem* pelem, int arg) {
         ide_read(hd, sb_buf->block_bitmap_lba, cur_part->block_bitmap.bits,
                  sb_buf->block_bitmap_sects);  // 读入block bitmap
 
-        cur_part->inode_bitmap.bits = (uint8_t*)sys_malloc(
+        cur_part->inode_bitmap.bits = (uint8_t*)kmalloc(
             sb_buf->inode_bitmap_sects *
             SECTOR_SIZE);  // 申请当前分区的inode bitmap空间
         if (cur_part->inode_bitmap.bits == NULL) {
@@ -62,6 +62,8 @@ static bool mount_partition(struct list_elem* pelem, int arg) {
                  sb_buf->inode_bitmap_sects);  // 读入inode bitmap
 
         list_init(&cur_part->open_inodes);
+        rwlock_init(&cur_part->tree_lock);
+        rwlock_init(&cur_part->open_inodes_lock);
 
         printk("mount %s done!\n", part->name);
         return true;
@@ -124,7 +126,7 @@ static void partition_format(struct partition* part) {
     buf_size =
         (buf_size >= sb.inode_table_sects ? buf_size : sb.inode_table_sects) *
         SECTOR_SIZE;
-    uint8_t* buf = (uint8_t*)sys_malloc(buf_size);
+    uint8_t* buf = (uint8_t*)kmalloc(buf_size);
 
     // 把块位图初始化并写入sb.block_bitmap_lba
     buf[0] |= 0x01;
@@ -261,7 +263,7 @@ static int search_file(const char* pathname,
 }
 
 // 成功返回fd, 否则返回-1
-int32_t sys_open(const char* pathname, uint8_t flags) {
+static int32_t do_open(const char* pathname, uint8_t flags) {
     // 最后一个字符是/, 说明是目录, 这个函数只处理普通文件
     // 目录使用dir_open
     if (pathname[strlen(pathname) - 1] == '/') {
@@ -324,8 +326,25 @@ int32_t sys_open(const char* pathname, uint8_t flags) {
     return fd;
 }
 
+// 创建文件要修改目录, 持写锁; 只是打开已有文件持读锁
+int32_t sys_open(const char* pathname, uint8_t flags) {
+    bool create = (flags & O_CREAT) != 0;
+    if (create) {
+        rwlock_write_acquire(&cur_part->tree_lock);
+    } else {
+        rwlock_read_acquire(&cur_part->tree_lock);
+    }
+    int32_t ret = do_open(pathname, flags);
+    if (create) {
+        rwlock_write_release(&cur_part->tree_lock);
+    } else {
+        rwlock_read_release(&cur_part->tree_lock);
+    }
+    return ret;
+}
+
 static uint32_t fd_local2global(uint32_t local_fd) {
-    struct task_struct* cur = running_thread();
+    struct task_struct* cur = running_thread()->group_leader;
     int32_t global_fd = cur->fd_table[local_fd];
     ASSERT(global_fd >= 0 && global_fd < MAX_FILE_OPEN);
     return (uint32_t)global_fd;
@@ -336,7 +355,7 @@ int32_t sys_close(int32_t fd) {
     if (fd > 2) {
         uint32_t global_fd = fd_local2global(fd);
         ret = file_close(&file_table[global_fd]);
-        running_thread()->fd_table[fd] = -1;
+        running_thread()->group_leader->fd_table[fd] = -1;
     }
     return ret;
 }
@@ -345,7 +364,7 @@ int32_t sys_close(int32_t fd) {
 void filesys_init() {
     uint8_t channel_no = 0, dev_no, part_idx = 0;
     struct super_block* sb_buf =
-        (struct super_block*)sys_malloc(SECTOR_SIZE);  // 用来存储超级块
+        (struct super_block*)kmalloc(SECTOR_SIZE);  // 用来存储超级块
     if (sb_buf == NULL) { PANIC("alloc memory failed!"); }
     printk("searching filesystem......\n");
     while (channel_no < channel_cnt) {
@@ -426,7 +445,8 @@ int32_t sys_read(int32_t fd, void* buf, uint32_t count) {
         char* buffer = buf;
         uint32_t bytes_read = 0;
         while (bytes_read < count) {
-            *buffer = ioq_getchar(&kbd_buf);
+            // 所属进程在退出, 已经读到的照常返回
+            if (!ioq_getchar(&kbd_buf, buffer)) { break; }
             bytes_read++;
             buffer++;
         }
@@ -438,6 +458,13 @@ int32_t sys_read(int32_t fd, void* buf, uint32_t count) {
     return ret;
 }
 
+// 写操作直接落盘, 没有要刷的缓存, 只检查fd是否有效
+int32_t sys_fsync(int32_t fd) {
+    if (fd < 0 || fd >= MAX_FILES_OPEN_PER_PROC) { return -1; }
+    if (fd <= stderr_no) { return 0; }
+    return running_thread()->group_leader->fd_table[fd] == -1 ? -1 : 0;
+}
+
 // lseek, 根据whence对fd进行offset
 int32_t sys_lseek(int32_t fd, int32_t offset, uint8_t whence) {
     if (fd < 0) {
@@ -460,7 +487,7 @@ int32_t sys_lseek(int32_t fd, int32_t offset, uint8_t whence) {
 }
 
 // 删除普通文件, 成功返回0, 失败返回-1
-int32_t sys_unlink(const char* pathname) {
+static int32_t do_unlink(const char* pathname) {
     ASSERT(strlen(pathname) < MAX_PATH_LEN);
 
     // 搜索, 也就是先检查文件存不存在
@@ -497,7 +524,7 @@ int32_t sys_unlink(const char* pathname) {
     }
     ASSERT(file_idx == MAX_FILE_OPEN);
 
-    void* io_buf = sys_malloc(SECTOR_SIZE + SECTOR_SIZE);
+    void* io_buf = kmalloc(SECTOR_SIZE + SECTOR_SIZE);
     if (io_buf == NULL) {
         dir_close(searched_record.parent_dir);
         printk("sys_unlink: malloc for io_buf failed\n");
@@ -512,12 +539,19 @@ int32_t sys_unlink(const char* pathname) {
     return 0;
 }
 
+int32_t sys_unlink(const char* pathname) {
+    rwlock_write_acquire(&cur_part->tree_lock);
+    int32_t ret = do_unlink(pathname);
+    rwlock_write_release(&cur_part->tree_lock);
+    return ret;
+}
+
 // 创建目录 pathname, 成功返回0, 失败返回-1
-int32_t sys_mkdir(const char* pathname) {
+static int32_t do_mkdir(const char* pathname) {
     uint8_t rollback_step = 0;  // 用于操作失败时回滚各资源状态
-    void* io_buf = sys_malloc(SECTOR_SIZE * 2);
+    void* io_buf = kmalloc(SECTOR_SIZE * 2);
     if (io_buf == NULL) {
-        printk("sys_mkdir: sys_malloc for io_buf failed\n");
+        printk("sys_mkdir: kmalloc for io_buf failed\n");
         return -1;
     }
 
@@ -634,8 +668,15 @@ rollback:  // 因为某步骤操作失败而回滚
     return -1;
 }
 
+int32_t sys_mkdir(const char* pathname) {
+    rwlock_write_acquire(&cur_part->tree_lock);
+    int32_t ret = do_mkdir(pathname);
+    rwlock_write_release(&cur_part->tree_lock);
+    return ret;
+}
+
 // 目录打开成功后返回目录指针, 失败返回NULL
-struct dir* sys_opendir(const char* name) {
+static struct dir* do_opendir(const char* name) {
     ASSERT(strlen(name) < MAX_PATH_LEN);
     // 如果是根目录'/',直接返回&root_dir
     if (name[0] == '/' && (name[1] == 0 || name[0] == '.')) {
@@ -662,6 +703,13 @@ struct dir* sys_opendir(const char* name) {
     return ret;
 }
 
+struct dir* sys_opendir(const char* name) {
+    rwlock_read_acquire(&cur_part->tree_lock);
+    struct dir* ret = do_opendir(name);
+    rwlock_read_release(&cur_part->tree_lock);
+    return ret;
+}
+
 // 成功关闭目录dir返回0, 失败返回-1
 int32_t sys_closedir(struct dir* dir) {
     int32_t ret = -1;
@@ -675,7 +723,10 @@ int32_t sys_closedir(struct dir* dir) {
 // 读取目录dir的1个目录项,成功后返回其目录项地址,到目录尾时或出错时返回NULL
 struct dir_entry* sys_readdir(struct dir* dir) {
     ASSERT(dir != NULL);
-    return dir_read(dir);
+    rwlock_read_acquire(&cur_part->tree_lock);
+    struct dir_entry* dir_e = dir_read(dir);
+    rwlock_read_release(&cur_part->tree_lock);
+    return dir_e;
 }
 
 // 把目录dir的指针dir_pos置0
@@ -684,7 +735,7 @@ void sys_rewinddir(struct dir* dir) {
 }
 
 // rmdir, 只能删除空目录, 成功返回0, 失败返回-1
-int32_t sys_rmdir(const char* pathname) {
+static int32_t do_rmdir(const char* pathname) {
     // 先检查待删除的文件是否存在
     struct path_search_record searched_record;
     memset(&searched_record, 0, sizeof(struct path_search_record));
@@ -715,6 +766,13 @@ int32_t sys_rmdir(const char* pathname) {
     return retval;
 }
 
+int32_t sys_rmdir(const char* pathname) {
+    rwlock_write_acquire(&cur_part->tree_lock);
+    int32_t ret = do_rmdir(pathname);
+    rwlock_write_release(&cur_part->tree_lock);
+    return ret;
+}
+
 // 获得父目录的inode编号
 static uint32_t get_parent_dir_inode_nr(uint32_t child_inode_nr, void* io_buf) {
     struct inode* child_dir_inode = inode_open(cur_part, child_inode_nr);
@@ -777,14 +835,14 @@ static int get_child_dir_name(uint32_t p_inode_nr,
 }
 
 // 把当前工作目录绝对路径写入buf, size是buf的大小. 失败返回NULL
-char* sys_getcwd(char* buf, uint32_t size) {
+static char* do_getcwd(char* buf, uint32_t size) {
     if (buf == NULL) return NULL;
-    void* io_buf = sys_malloc(SECTOR_SIZE);
+    void* io_buf = kmalloc(SECTOR_SIZE);
     if (io_buf == NULL) return NULL;
 
     struct task_struct* cur_thread = running_thread();
     int32_t parent_inode_nr = 0;
-    int32_t child_inode_nr = cur_thread->cwd_inode_nr;
+    int32_t child_inode_nr = cur_thread->group_leader->cwd_inode_nr;
 
     // 最大支持4096个inode
     ASSERT(child_inode_nr >= 0 && child_inode_nr < 4096);
@@ -826,14 +884,21 @@ char* sys_getcwd(char* buf, uint32_t size) {
     return buf;
 }
 
+char* sys_getcwd(char* buf, uint32_t size) {
+    rwlock_read_acquire(&cur_part->tree_lock);
+    char* ret = do_getcwd(buf, size);
+    rwlock_read_release(&cur_part->tree_lock);
+    return ret;
+}
+
 // 更改当前工作目录为绝对路径path, 成功则返回0, 失败返回-1
-int32_t sys_chdir(const char* path) {
+static int32_t do_chdir(const char* path) {
     struct path_search_record searched_record;
     memset(&searched_record, 0, sizeof(struct path_search_record));
     int inode_no = search_file(path, &searched_record);
     if (inode_no != -1 && searched_record.file_type == FT_DIRECTORY) {
         // 找到文件并且文件类型是目录
-        running_thread()->cwd_inode_nr = inode_no;
+        running_thread()->group_leader->cwd_inode_nr = inode_no;
         dir_close(searched_record.parent_dir);
         return 0;
     }
@@ -842,8 +907,15 @@ int32_t sys_chdir(const char* path) {
     return -1;
 }
 
+int32_t sys_chdir(const char* path) {
+    rwlock_read_acquire(&cur_part->tree_lock);
+    int32_t ret = do_chdir(path);
+    rwlock_read_release(&cur_part->tree_lock);
+    return ret;
+}
+
 // 根据path代表的文件, 在buf中填写相关信息, 成功返回0, 失败返回-1
-int32_t sys_stat(const char* path, struct stat* buf) {
+static int32_t do_stat(const char* path, struct stat* buf) {
     // 若直接查看根目录'/'
     if (!strcmp(path, "/") || !strcmp(path, "/.") || !strcmp(path, "/..")) {
         buf->st_filetype = FT_DIRECTORY;
@@ -872,6 +944,13 @@ int32_t sys_stat(const char* path, struct stat* buf) {
     return ret;
 }
 
+int32_t sys_stat(const char* path, struct stat* buf) {
+    rwlock_read_acquire(&cur_part->tree_lock);
+    int32_t ret = do_stat(path, buf);
+    rwlock_read_release(&cur_part->tree_lock);
+    return ret;
+}
+
 void sys_putchar(char char_asci) {
     console_put_char(char_asci);
 }
@@ -61,57 +61,73 @@ void inode_sync(struct partition* part, struct inode* inode, void* io_buf) {
     }
 }
 
-struct inode* inode_open(struct partition* part, uint32_t inode_no) {
-    // 先从打开inode表中找, 找到了直接返回
+// 在打开inode表中找inode_no, 找到就增加打开次数. 调用者至少持有读锁
+static struct inode* open_inodes_find(struct partition* part, uint32_t inode_no) {
     struct list_elem* elem = part->open_inodes.head.next;
-    struct inode* inode_found;
     while (elem != &part->open_inodes.tail) {
-        inode_found = elem2entry(struct inode, inode_tag, elem);
+        struct inode* inode_found = elem2entry(struct inode, inode_tag, elem);
         if (inode_found->i_no == inode_no) {
+            // 读者之间可能同时增加计数, 关中断保证不丢失
+            enum intr_status old_status = intr_disable();
             inode_found->i_open_cnts++;
+            intr_set_status(old_status);
             return inode_found;
         }
         elem = elem->next;
     }
+    return NULL;
+}
+
+struct inode* inode_open(struct partition* part, uint32_t inode_no) {
+    // 先从打开inode表中找, 找到了直接返回. 多数情况都能命中, 只需读锁
+    rwlock_read_acquire(&part->open_inodes_lock);
+    struct inode* inode_found = open_inodes_find(part, inode_no);
+    rwlock_read_release(&part->open_inodes_lock);
+    if (inode_found != NULL) { return inode_found; }
 
     // 找不到, 从硬盘读进来, 并加到链表中
     // 为了inode能被其他进程共享, 需要把inode创建在内核空间中
-    // 具体实现方式是把pgdir暂时置为NULL
     struct inode_position inode_pos; 
     inode_locate(part, inode_no, &inode_pos);
-    struct task_struct* cur = running_thread();
-    uint32_t* cur_pagedir_bak = cur->pgdir;
-    cur->pgdir = NULL;
-    inode_found = (struct inode*)sys_malloc(sizeof(struct inode)); // 得到内核空间的内存
-    cur->pgdir = cur_pagedir_bak;
+    inode_found = (struct inode*)kmalloc(sizeof(struct inode)); // 得到内核空间的内存
 
     char* inode_buf;
     if (inode_pos.two_sec) {
-        inode_buf = (char*)sys_malloc(1024);
+        inode_buf = (char*)kmalloc(1024);
         ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
     } else {
-        inode_buf = (char*)sys_malloc(512);
+        inode_buf = (char*)kmalloc(512);
         ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
     }
     memcpy(inode_found, inode_buf + inode_pos.off_size, sizeof(struct inode));
-    list_push(&part->open_inodes, &inode_found->inode_tag);
-    inode_found->i_open_cnts = 1;
     sys_free(inode_buf);
+
+    // 读盘期间别的任务可能已经打开了同一个inode, 加写锁后再找一次
+    rwlock_write_acquire(&part->open_inodes_lock);
+    struct inode* inode_opened = open_inodes_find(part, inode_no);
+    if (inode_opened == NULL) {
+        list_push(&part->open_inodes, &inode_found->inode_tag);
+        inode_found->i_open_cnts = 1;
+    }
+    rwlock_write_release(&part->open_inodes_lock);
+
+    if (inode_opened != NULL) {
+        sys_free(inode_found);
+        return inode_opened;
+    }
     return inode_found;
 }
 
 void inode_close(struct inode* inode) {
-    enum intr_status old_status = intr_disable();
+    rwlock_write_acquire(&cur_part->open_inodes_lock);
     inode->i_open_cnts--;
-    if (inode->i_open_cnts == 0) { // 减到0了, 释放内存
-        list_remove(&inode->inode_tag);
-        struct task_struct* cur = running_thread();
-        uint32_t* cur_pagedir_bak = cur->pgdir;
-        cur->pgdir = NULL;
+    bool last = (inode->i_open_cnts == 0);
+    if (last) { list_remove(&inode->inode_tag); }
+    rwlock_write_release(&cur_part->open_inodes_lock);
+
+    if (last) { // 减到0了, 释放内存
         sys_free(inode);
-        cur->pgdir = cur_pagedir_bak;
     }
-    intr_set_status(old_status);
 }
 
 // 初始化new_inode
@@ -190,7 +206,7 @@ void inode_release(struct partition* part, uint32_t inode_no) {
     bitmap_sync(cur_part, inode_no, INODE_BITMAP);
 
     // 以下三行不是必要的, 可以删除
-    void* io_buf = sys_malloc(1024);
+    void* io_buf = kmalloc(1024);
     inode_delete(part, inode_no, io_buf);
     sys_free(io_buf);
 
@@ -0,0 +1,42 @@
+#ifndef __KERNEL_CPU_H
+#define __KERNEL_CPU_H
+
+#include "global.h"
+#include "stdint.h"
+
+#define CPUID_EDX_SEP (1 << 11)  // 支持sysenter/sysexit
+
+static inline void cpuid(uint32_t leaf,
+                         uint32_t* eax,
+                         uint32_t* ebx,
+                         uint32_t* ecx,
+                         uint32_t* edx) {
+    asm volatile("cpuid"
+                 : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                 : "a"(leaf));
+}
+
+// 能否用sysenter/sysexit. 内核据此设置sysenter入口, 用户态的系统调用桩据此
+// 选择进入内核的方式, 两边共用这一个判断
+static inline bool sysenter_supported(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_SEP)) { return false; }
+    // Pentium Pro的SEP位是错的
+    uint32_t family = (eax >> 8) & 0xf;
+    uint32_t model = (eax >> 4) & 0xf;
+    uint32_t stepping = eax & 0xf;
+    return !(family == 6 && model < 3 && stepping < 3);
+}
+
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr"
+                 :
+                 : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+#endif
@@ -18,4 +18,16 @@ void panic_spin(char* filename,
         }
 #endif
 
-#endif
\ No newline at end of file
+// 调试级别, 编译时用-DDEBUG_LEVEL=n指定. 1只做O(1)的检查,
+// 2还做遍历链表这类开销大的检查, 它们在关中断时执行, 会拖慢每次任务切换
+#ifndef DEBUG_LEVEL
+#    define DEBUG_LEVEL 1
+#endif
+
+#if DEBUG_LEVEL >= 2
+#    define ASSERT_SLOW(CONDITION) ASSERT(CONDITION)
+#else
+#    define ASSERT_SLOW(CONDITION) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,180 @@
+#include "fpu.h"
+#include "cpu.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "print.h"
+#include "string.h"
+#include "thread.h"
+
+#define CR0_MP (1 << 1)  // 配合TS, wait/fwait指令也触发#NM
+#define CR0_EM (1 << 2)  // 置位时fpu指令触发#UD, 必须清掉
+#define CR0_TS (1 << 3)  // 任务切换标志, 置位时fpu/SSE指令触发#NM
+#define CR0_NE (1 << 5)  // 浮点错误走#MF而不是IRQ13
+#define CR4_OSFXSR (1 << 9)       // 允许fxsave/fxrstor和SSE指令
+#define CR4_OSXMMEXCPT (1 << 10)  // SIMD浮点异常走#XF
+
+#define CPUID_EDX_FXSR (1 << 24)
+#define CPUID_EDX_SSE (1 << 25)
+
+#define MXCSR_DEFAULT 0x1f80  // 屏蔽所有SIMD浮点异常
+
+#define FPU_STATES_PER_PAGE (PG_SIZE / sizeof(struct fpu_state))
+
+static bool has_fxsr;  // 没有fxsr的老cpu只能用fnsave保存x87
+static bool has_sse;   // 打开了SSE(CR4.OSFXSR), 否则SSE指令触发#UD
+static struct task_struct* fpu_owner;  // fpu寄存器中保存的是哪个任务的状态
+
+// 空闲的保存区, 用保存区开头4字节串成单链表
+static struct fpu_state* free_states;
+
+// 从内核申请一页切成8个保存区, 页对齐所以每个都满足16字节对齐
+static struct fpu_state* fpu_state_alloc() {
+    if (free_states == NULL) {
+        struct fpu_state* page = get_kernel_pages(1);
+        if (page == NULL) { return NULL; }
+        uint32_t i;
+        for (i = 0; i < FPU_STATES_PER_PAGE; i++) {
+            *(struct fpu_state**)&page[i] = free_states;
+            free_states = &page[i];
+        }
+    }
+    struct fpu_state* state = free_states;
+    free_states = *(struct fpu_state**)state;
+    return state;
+}
+
+static void fpu_state_free(struct fpu_state* state) {
+    *(struct fpu_state**)state = free_states;
+    free_states = state;
+}
+
+static inline void clts() {
+    asm volatile("clts");
+}
+
+static inline void stts() {
+    uint32_t cr0;
+    asm volatile("movl %%cr0, %0" : "=r"(cr0));
+    asm volatile("movl %0, %%cr0" : : "r"(cr0 | CR0_TS));
+}
+
+static void fpu_save(struct fpu_state* state) {
+    if (has_fxsr) {
+        asm volatile("fxsave %0" : "=m"(*state));
+    } else {
+        asm volatile("fnsave %0; fwait" : "=m"(*state));
+    }
+}
+
+static void fpu_restore(struct fpu_state* state) {
+    if (has_fxsr) {
+        asm volatile("fxrstor %0" : : "m"(*state));
+    } else {
+        asm volatile("frstor %0" : : "m"(*state));
+    }
+}
+
+// 第一次使用fpu的任务从干净的状态开始
+static void fpu_reset() {
+    asm volatile("fninit");
+    if (has_sse) {
+        uint32_t mxcsr = MXCSR_DEFAULT;
+        asm volatile("ldmxcsr %0" : : "m"(mxcsr));
+    }
+}
+
+// #NM: 任务在TS置位时用了fpu. 把寄存器里上一个任务的状态存回去, 换成当前任务的
+static void fpu_nm_handler(uint8_t vec_nr UNUSED) {
+    struct task_struct* cur = running_thread();
+    clts();
+    if (fpu_owner == cur) { return; }
+    if (fpu_owner != NULL) { fpu_save(fpu_owner->fpu); }
+    if (cur->fpu == NULL) {
+        cur->fpu = fpu_state_alloc();
+        if (cur->fpu == NULL) { PANIC("fpu: no memory for fpu state\n"); }
+        fpu_reset();
+    } else {
+        fpu_restore(cur->fpu);
+    }
+    fpu_owner = cur;
+}
+
+// 任务切换时调用. fpu寄存器里不是next的状态就置TS, 等它真正用到fpu时再换
+void fpu_switch(struct task_struct* next) {
+    if (fpu_owner == next) {
+        clts();
+    } else {
+        stts();
+    }
+}
+
+// 把pthread留在fpu寄存器里的状态写回保存区
+void fpu_flush(struct task_struct* pthread) {
+    enum intr_status old_status = intr_disable();
+    if (fpu_owner == pthread) {
+        clts();
+        fpu_save(pthread->fpu);
+        // fnsave会重置fpu, 放弃所有权让下次使用时重新载入
+        fpu_owner = NULL;
+        stts();
+    }
+    intr_set_status(old_status);
+}
+
+// fork时复制父进程的fpu状态, 子进程的pcb是整页复制来的, 不能共用保存区
+int32_t fpu_copy(struct task_struct* child, struct task_struct* parent) {
+    child->fpu = NULL;
+    if (parent->fpu == NULL) { return 0; }
+    fpu_flush(parent);
+    enum intr_status old_status = intr_disable();
+    child->fpu = fpu_state_alloc();
+    intr_set_status(old_status);
+    if (child->fpu == NULL) { return -1; }
+    memcpy(child->fpu, parent->fpu, sizeof(struct fpu_state));
+    return 0;
+}
+
+// 任务退出或exec时丢弃fpu状态
+void fpu_release(struct task_struct* pthread) {
+    enum intr_status old_status = intr_disable();
+    if (fpu_owner == pthread) {
+        fpu_owner = NULL;
+        if (pthread == running_thread()) { stts(); }
+    }
+    if (pthread->fpu != NULL) {
+        fpu_state_free(pthread->fpu);
+        pthread->fpu = NULL;
+    }
+    intr_set_status(old_status);
+}
+
+// 打开fpu和SSE, 置TS使第一次使用fpu时进入#NM
+void fpu_init() {
+    put_str("fpu_init start\n");
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    has_fxsr = (edx & CPUID_EDX_FXSR) != 0;
+    has_sse = has_fxsr && (edx & CPUID_EDX_SSE);
+
+    uint32_t cr0;
+    asm volatile("movl %%cr0, %0" : "=r"(cr0));
+    cr0 &= ~CR0_EM;
+    cr0 |= CR0_MP | CR0_NE;
+    asm volatile("movl %0, %%cr0" : : "r"(cr0));
+
+    if (has_sse) {
+        uint32_t cr4;
+        asm volatile("movl %%cr4, %0" : "=r"(cr4));
+        cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+        asm volatile("movl %0, %%cr4" : : "r"(cr4));
+    }
+    fpu_owner = NULL;
+    stts();
+    register_handler(7, fpu_nm_handler);
+    put_str("   fxsr: ");
+    put_str(has_fxsr ? "yes" : "no");
+    put_str(", sse: ");
+    put_str(has_sse ? "yes" : "no");
+    put_str("\nfpu_init done\n");
+}
@@ -0,0 +1,22 @@
+#ifndef __KERNEL_FPU_H
+#define __KERNEL_FPU_H
+
+#include "global.h"
+#include "stdint.h"
+
+#define FPU_STATE_SIZE 512  // fxsave保存区的大小, 要求16字节对齐
+
+struct task_struct;
+
+// 任务的x87/SSE寄存器. 第一次使用fpu时才分配
+struct fpu_state {
+    uint8_t regs[FPU_STATE_SIZE];
+} __attribute__((aligned(16)));
+
+void fpu_switch(struct task_struct* next);
+void fpu_flush(struct task_struct* pthread);
+int32_t fpu_copy(struct task_struct* child, struct task_struct* parent);
+void fpu_release(struct task_struct* pthread);
+void fpu_init(void);
+
+#endif
@@ -46,9 +46,18 @@
 #define SELECTOR_U_CODE ((5 << 3) + (TI_GDT << 2) + RPL3)
 #define SELECTOR_U_DATA ((6 << 3) + (TI_GDT << 2) + RPL3)
 #define SELECTOR_U_STACK SELECTOR_U_DATA
+// 第7个是用户线程的TLS段, 基址随任务切换更新为线程的tls
+#define SELECTOR_U_TLS ((7 << 3) + (TI_GDT << 2) + RPL3)
+// 第8~11个给sysenter/sysexit用. 它们要求内核代码段, 内核栈段, 用户代码段,
+// 用户栈段依次相邻, 与上面的布局对不上, 只好另外复制一组
+#define SELECTOR_SYSENTER_CS ((8 << 3) + (TI_GDT << 2) + RPL0)
 
 #define GDT_ATTR_HIGH \
     ((DESC_G_4K << 7) + (DESC_D_32 << 6) + (DESC_L << 5) + (DESC_AVL << 4))
+#define GDT_CODE_ATTR_LOW_DPL0 \
+    ((DESC_P << 7) + (DESC_DPL_0 << 5) + (DESC_S_CODE << 4) + DESC_TYPE_CODE)
+#define GDT_DATA_ATTR_LOW_DPL0 \
+    ((DESC_P << 7) + (DESC_DPL_0 << 5) + (DESC_S_DATA << 4) + DESC_TYPE_DATA)
 #define GDT_CODE_ATTR_LOW_DPL3 \
     ((DESC_P << 7) + (DESC_DPL_3 << 5) + (DESC_S_CODE << 4) + DESC_TYPE_CODE)
 #define GDT_DATA_ATTR_LOW_DPL3 \
@@ -1,6 +1,8 @@
 #include "init.h"
 #include "console.h"
+#include "fpu.h"
 #include "fs.h"
+#include "futex.h"
 #include "ide.h"
 #include "interrupt.h"
 #include "keyboard.h"
@@ -9,14 +11,22 @@
 #include "syscall-init.h"
 #include "thread.h"
 #include "timer.h"
+#include "tsc.h"
 #include "tss.h"
+#include "vdso.h"
+#include "workqueue.h"
 
 void init_all() {
     put_str("init_all\n");
     idt_init();
+    fpu_init();
     mem_init();
+    vdso_init();
     thread_init();
+    futex_init();
+    workqueue_init();
     timer_init();
+    tsc_init();
     console_init();
     keyboard_init();
     tss_init();
@@ -22,14 +22,17 @@ int main(void) {
 
     cls_screen();
     console_put_str("[geon6@localhost /]$ ");
-    while (1) {}
+    // 主线程没有别的事可做, 睡下去把cpu让给其他任务
+    while (1) { thread_block(TASK_BLOCKED); }
     return 0;
 }
 
+// init回收所有子进程, 包括收养的孤儿
 void init() {
     uint32_t ret_pid = fork();
     if (ret_pid) {
-        while (1) {}
+        int32_t status;
+        while (1) { wait(&status); }
     } else {
         my_shell();
     }
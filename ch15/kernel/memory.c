@@ -63,15 +63,16 @@ static void* vaddr_get(enum pool_flags pf, uint32_t pg_cnt) {
         }
         vaddr_start = kernel_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
     } else {                                         // 用户内存池
-        struct task_struct* cur = running_thread();  // 获取用户进程
+        // 获取用户进程. 同一进程的线程共用主线程的虚拟地址池
+        struct virtual_addr* uvaddr =
+            &running_thread()->group_leader->userprog_vaddr;
         // 从用户进程的虚拟地址空间分配虚拟页
-        bit_idx_start = bitmap_scan(&cur->userprog_vaddr.vaddr_bitmap, pg_cnt);
+        bit_idx_start = bitmap_scan(&uvaddr->vaddr_bitmap, pg_cnt);
         if (bit_idx_start == -1) { return NULL; }
         while (cnt < pg_cnt) {
-            bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, bit_idx_start + cnt++,
-                       1);
+            bitmap_set(&uvaddr->vaddr_bitmap, bit_idx_start + cnt++, 1);
         }
-        vaddr_start = cur->userprog_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
+        vaddr_start = uvaddr->vaddr_start + bit_idx_start * PG_SIZE;
         ASSERT((uint32_t)vaddr_start < (0xc0000000 - PG_SIZE));
     }
     return (void*)vaddr_start;
@@ -162,7 +163,7 @@ void* get_kernel_pages(uint32_t pg_cnt) {
 void* get_user_pages(uint32_t pg_cnt) {
     lock_acquire(&user_pool.lock);
     void* vaddr = malloc_page(PF_USER, pg_cnt);
-    memset(vaddr, 0, pg_cnt * PG_SIZE);
+    if (vaddr != NULL) { memset(vaddr, 0, pg_cnt * PG_SIZE); }
     lock_release(&user_pool.lock);
     return vaddr;
 }
@@ -178,9 +179,10 @@ void* get_a_page(enum pool_flags pf, uint32_t vaddr) {
 
     // pgdir不空说明thread有自己的页目录表和页表. 是用户进程
     if (cur->pgdir != NULL && pf == PF_USER) {  // 用户进程申请用户内存
-        bit_idx = (vaddr - cur->userprog_vaddr.vaddr_start) / PG_SIZE;
+        struct virtual_addr* uvaddr = &cur->group_leader->userprog_vaddr;
+        bit_idx = (vaddr - uvaddr->vaddr_start) / PG_SIZE;
         ASSERT(bit_idx > 0);
-        bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, bit_idx, 1);
+        bitmap_set(&uvaddr->vaddr_bitmap, bit_idx, 1);
     } else if (cur->pgdir == NULL && pf == PF_KERNEL) {  // 内核线程申请内核内存
         bit_idx = (vaddr - kernel_vaddr.vaddr_start) / PG_SIZE;
         ASSERT(bit_idx > 0);
@@ -233,25 +235,11 @@ static struct arena* block2arena(struct mem_block* b) {
     return (struct arena*)((uint32_t)b & 0xfffff000);
 }
 
-void* sys_malloc(uint32_t size) {
-    enum pool_flags PF;
-    struct pool* mem_pool;
-    uint32_t pool_size;
-    struct mem_block_desc* descs;
-    struct task_struct* cur_thread = running_thread();
-
-    if (cur_thread->pgdir ==
-        NULL) {  // 没有自己的页目录表和页表, 说明是内核线程
-        PF = PF_KERNEL;
-        pool_size = kernel_pool.pool_size;
-        mem_pool = &kernel_pool;
-        descs = k_block_descs;
-    } else {  // 用户线程
-        PF = PF_USER;
-        pool_size = user_pool.pool_size;
-        mem_pool = &user_pool;
-        descs = cur_thread->u_block_desc;
-    }
+// 从PF对应的内存池中分配size字节, 小块从descs的空闲链表中取
+static void* block_malloc(enum pool_flags PF, struct mem_block_desc* descs,
+                          uint32_t size) {
+    struct pool* mem_pool = PF == PF_KERNEL ? &kernel_pool : &user_pool;
+    uint32_t pool_size = mem_pool->pool_size;
 
     if (!(size > 0 && size < pool_size)) {  // 错误的size, 不分配
         return NULL;
@@ -305,7 +293,7 @@ void* sys_malloc(uint32_t size) {
             for (block_idx = 0; block_idx < descs[desc_idx].blocks_per_arena;
                  block_idx++) {
                 b = arena2block(a, block_idx);
-                ASSERT(!elem_find(&a->desc->free_list, &b->free_elem));
+                ASSERT_SLOW(!elem_find(&a->desc->free_list, &b->free_elem));
                 list_append(&a->desc->free_list, &b->free_elem);
             }
             intr_set_status(old_status);
@@ -322,6 +310,22 @@ void* sys_malloc(uint32_t size) {
     }
 }
 
+void* sys_malloc(uint32_t size) {
+    struct task_struct* cur_thread = running_thread();
+    if (cur_thread->pgdir ==
+        NULL) {  // 没有自己的页目录表和页表, 说明是内核线程
+        return block_malloc(PF_KERNEL, k_block_descs, size);
+    }
+    // 用户线程
+    return block_malloc(PF_USER, cur_thread->group_leader->u_block_desc, size);
+}
+
+// 不管当前是内核线程还是用户进程, 都从内核内存池分配.
+// 给所有进程共用的内核数据用, 比如inode, 目录项和读写硬盘的缓冲区
+void* kmalloc(uint32_t size) {
+    return block_malloc(PF_KERNEL, k_block_descs, size);
+}
+
 // 将pg_phy_addr所在page回收到物理内存池, 具体就是修改bitmap
 void pfree(uint32_t pg_phy_addr) {
     struct pool* mem_pool;
@@ -353,12 +357,11 @@ static void vaddr_remove(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
             bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 0);
         }
     } else {  // 用户虚拟内存池
-        struct task_struct* cur_thread = running_thread();
-        bit_idx_start =
-            (vaddr - cur_thread->userprog_vaddr.vaddr_start) / PG_SIZE;
+        struct virtual_addr* uvaddr =
+            &running_thread()->group_leader->userprog_vaddr;
+        bit_idx_start = (vaddr - uvaddr->vaddr_start) / PG_SIZE;
         while (cnt < pg_cnt) {
-            bitmap_set(&cur_thread->userprog_vaddr.vaddr_bitmap,
-                       bit_idx_start + cnt++, 0);
+            bitmap_set(&uvaddr->vaddr_bitmap, bit_idx_start + cnt++, 0);
         }
     }
 }
@@ -400,6 +403,37 @@ void mfree_page(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
     }
 }
 
+// 进程退出时一次性释放当前页目录下用户空间的所有物理页和页表.
+// 直接遍历页表, 不像mfree_page那样逐页查虚拟地址, 清pte和invlpg, 最后重新加载cr3刷新tlb.
+// 不属于用户物理内存池的页(比如vdso映射的内核页)不是进程的, 跳过.
+// shared_pde项的页表随页目录一起分配, 不在这里释放. 虚拟地址位图和页目录由调用者整体释放
+void release_user_space(uint32_t shared_pde) {
+    lock_acquire(&user_pool.lock);
+    lock_acquire(&kernel_pool.lock);
+    uint32_t* pgdir = (uint32_t*)0xfffff000;
+    uint32_t pde_idx, pte_idx;
+    for (pde_idx = 0; pde_idx < 0x300; pde_idx++) {
+        if (!(pgdir[pde_idx] & PG_P_1)) { continue; }
+        uint32_t* pt = (uint32_t*)(0xffc00000 + pde_idx * PG_SIZE);
+        for (pte_idx = 0; pte_idx < 1024; pte_idx++) {
+            if (!(pt[pte_idx] & PG_P_1)) { continue; }
+            uint32_t pg_phy_addr = pt[pte_idx] & 0xfffff000;
+            if (pg_phy_addr >= user_pool.phy_addr_start) {
+                pfree(pg_phy_addr);
+                pt[pte_idx] = 0;
+            }
+        }
+        if (pde_idx != shared_pde) {
+            pfree(pgdir[pde_idx] & 0xfffff000);
+            pgdir[pde_idx] = 0;
+        }
+    }
+    uint32_t cr3;
+    asm volatile("movl %%cr3, %0; movl %0, %%cr3" : "=r"(cr3) : : "memory");
+    lock_release(&kernel_pool.lock);
+    lock_release(&user_pool.lock);
+}
+
 // 回收ptr指向的内存
 void sys_free(void* ptr) {
     ASSERT(ptr != NULL);
@@ -407,8 +441,8 @@ void sys_free(void* ptr) {
         enum pool_flags PF;
         struct pool* mem_pool;
 
-        if (running_thread()->pgdir == NULL) {  // 内核线程
-            ASSERT((uint32_t)ptr >= K_HEAP_START);
+        // 按地址判断是哪个内存池的, 用户进程也可以释放kmalloc分配的内存
+        if ((uint32_t)ptr >= K_HEAP_START) {
             PF = PF_KERNEL;
             mem_pool = &kernel_pool;
         } else {
@@ -434,7 +468,8 @@ void sys_free(void* ptr) {
                 for (block_idx = 0; block_idx < a->desc->blocks_per_arena;
                      block_idx++) {
                     struct mem_block* b = arena2block(a, block_idx);
-                    ASSERT(elem_find(&a->desc->free_list, &b->free_elem));
+                    ASSERT(elem_linked(&b->free_elem));
+                    ASSERT_SLOW(elem_find(&a->desc->free_list, &b->free_elem));
                     list_remove(&b->free_elem);
                 }
                 mfree_page(PF, a, 1);
@@ -49,6 +49,7 @@ void* malloc_page(enum pool_flags pf, uint32_t pg_cnt);
 // 从内核物理内存池中申请pg_cng个页, 失败返回NULL, 成功返回虚拟地址.
 // 这个函数分配成功指的是分配虚拟页和物理页都成功了, 并且在页表中建立了映射.
 void* get_kernel_pages(uint32_t pg_cnt);
+void* get_user_pages(uint32_t pg_cnt);
 
 void* get_a_page(enum pool_flags pf, uint32_t vaddr);
 
@@ -58,10 +59,14 @@ void block_desc_init(struct mem_block_desc* desc_array);
 
 void* sys_malloc(uint32_t size);
 
+void* kmalloc(uint32_t size);
+
 void mfree_page(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt);
 
 void pfree(uint32_t pg_phy_addr);
 
+void release_user_space(uint32_t shared_pde);
+
 void sys_free(void* ptr);
 
 void* get_a_page_without_opvaddrbitmap(enum pool_flags pf, uint32_t vaddr);
@@ -0,0 +1,51 @@
+#include "softirq.h"
+#include "debug.h"
+#include "global.h"
+#include "interrupt.h"
+#include "sched.h"
+#include "thread.h"
+
+static softirq_handler* softirq_vec[NR_SOFTIRQS];
+static uint32_t softirq_pending;  // 待处理的软中断, 每种一位
+static bool softirq_running;      // 软中断不重入, 嵌套的中断只标记不执行
+
+void open_softirq(enum softirq_nr nr, softirq_handler handler) {
+    ASSERT(nr < NR_SOFTIRQS);
+    softirq_vec[nr] = handler;
+}
+
+// 一般在硬件中断处理程序中调用, 在这次中断返回前执行
+void raise_softirq(enum softirq_nr nr) {
+    enum intr_status old_status = intr_disable();
+    softirq_pending |= (1 << nr);
+    intr_set_status(old_status);
+}
+
+// kernel.S在硬件中断处理程序返回后调用, 此时关着中断.
+// 开中断执行待处理的软中断, 执行期间新标记的也一并处理完.
+// 软中断和中断一样借用被打断任务的栈, 不能睡眠
+void irq_exit() {
+    // 打断了软中断的中断只标记, 由外层的irq_exit处理, 也不在这里调度,
+    // 否则softirq_running会随被换下的任务一起留在cpu外
+    if (softirq_running) { return; }
+    if (softirq_pending != 0) {
+        softirq_running = true;
+        uint32_t pending;
+        while ((pending = softirq_pending) != 0) {
+            softirq_pending = 0;
+            intr_enable();
+            uint32_t nr;
+            for (nr = 0; nr < NR_SOFTIRQS; nr++) {
+                if (pending & (1 << nr)) { softirq_vec[nr](); }
+            }
+            intr_disable();
+        }
+        softirq_running = false;
+    }
+    // 时钟中断要求的调度和软中断中唤醒的实时任务的抢占都在这里进行
+    if (sched_need_resched()) { schedule(); }
+}
+
+bool in_softirq() {
+    return softirq_running;
+}
@@ -0,0 +1,22 @@
+#ifndef __KERNEL_SOFTIRQ_H
+#define __KERNEL_SOFTIRQ_H
+
+#include "global.h"
+#include "stdint.h"
+
+// 软中断. 硬件中断处理程序只做必须马上做的事, 剩下的标记为待处理,
+// 在中断返回前开着中断执行, 缩短关中断的时间
+enum softirq_nr {
+    BLOCK_SOFTIRQ,  // 硬盘请求完成
+    KBD_SOFTIRQ,    // 键盘扫描码解码
+    NR_SOFTIRQS
+};
+
+typedef void softirq_handler(void);
+
+void open_softirq(enum softirq_nr nr, softirq_handler handler);
+void raise_softirq(enum softirq_nr nr);
+void irq_exit(void);
+bool in_softirq(void);
+
+#endif
@@ -29,6 +29,18 @@ static inline uint8_t inb(uint16_t port) {
     return data;
 }
 
+// 向port写入一个双字
+static inline void outl(uint16_t port, uint32_t data) {
+    asm volatile("outl %0, %w1" : : "a" (data), "Nd" (port));
+}
+
+// 从port读入一个双字
+static inline uint32_t inl(uint16_t port) {
+    uint32_t data;
+    asm volatile ("inl %w1, %0" : "=a" (data) : "Nd" (port));
+    return data;
+}
+
 // 从port读入word_cnt个word, 并写入addr
 static inline void insw(uint16_t port, void* addr, uint32_t word_cnt) {
     asm volatile ("cld; rep insw" : "+D" (addr), "+c" (word_cnt) : "d" (port) : "memory");
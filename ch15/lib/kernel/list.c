@@ -29,10 +29,12 @@ void list_append(struct list* plist, struct list_elem* elem) {
     list_insert_before(&plist->tail, elem);
 }
 
+// 摘下的结点指针清空, 这样elem_linked能O(1)判断结点在不在链表中
 void list_remove(struct list_elem* pelem) {
     enum intr_status old_status = intr_disable();
     pelem->prev->next = pelem->next;
     pelem->next->prev = pelem->prev;
+    pelem->prev = pelem->next = NULL;
     intr_set_status(old_status);
 }
 
@@ -56,6 +58,12 @@ uint32_t list_len(struct list* plist) {
     return length;
 }
 
+// 结点是否在某个链表中. 结点要先清零或者从未挂上过链表, 摘下后由list_remove清空
+bool elem_linked(struct list_elem* elem) {
+    return elem->next != NULL;
+}
+
+// 遍历整个链表, 只用于调试检查
 bool elem_find(struct list* plist, struct list_elem* obj_elem) {
     struct list_elem* elem = plist->head.next;
     while (elem != &plist->tail) {
@@ -33,6 +33,7 @@ struct list_elem* list_pop(struct list* plist);
 bool list_empty(struct list* plist);
 uint32_t list_len(struct list* plist);
 struct list_elem* list_traversal(struct list* plist, function func, int arg);
+bool elem_linked(struct list_elem* elem);
 bool elem_find(struct list* plist, struct list_elem* obj_elem);
 
 #endif
@@ -1,43 +1,109 @@
 #include "syscall.h"
+#include "cpu.h"
+#include "tsc.h"
+#include "vdso.h"
 
-#define _syscall0(NUMBER)                                                  \
-    ({                                                                     \
-        int retval;                                                        \
-        asm volatile("int $0x80" : "=a"(retval) : "a"(NUMBER) : "memory"); \
-        retval;                                                            \
+// 是否用sysenter进入内核. -1表示还没探测, 第一次系统调用时用cpuid判断
+static int32_t fast_syscall = -1;
+
+// 内核线程也会调用这些函数. 它们不能用sysenter(sysexit只能回到3特权级),
+// 也没有映射vdso
+static inline bool user_mode() {
+    uint32_t cs;
+    asm("movl %%cs, %0" : "=r"(cs));
+    return (cs & 3) == 3;
+}
+
+static inline bool use_sysenter() {
+    if (fast_syscall == -1) { fast_syscall = sysenter_supported(); }
+    return fast_syscall && user_mode();
+}
+
+// 开关sysenter, 返回是否真的在用. 测量两种入口的开销时用
+bool syscall_set_fast(bool enable) {
+    fast_syscall = enable && sysenter_supported();
+    return fast_syscall;
+}
+
+// 经sysenter进入内核. 返回地址放esi, 用户栈顶放ebp, sysexit回来时会改写ecx和edx
+static int32_t sysenter_call(uint32_t nr,
+                             uint32_t arg1,
+                             uint32_t arg2,
+                             uint32_t arg3) {
+    asm volatile(
+        "pushl %%ebp\n\t"
+        "movl %%esp, %%ebp\n\t"
+        "movl $1f, %%esi\n\t"
+        "sysenter\n"
+        "1:\n\t"
+        "popl %%ebp"
+        : "+a"(nr), "+c"(arg2), "+d"(arg3)
+        : "b"(arg1)
+        : "esi", "memory");
+    return nr;
+}
+
+#define _syscall0(NUMBER)                                                \
+    ({                                                                   \
+        int retval;                                                      \
+        if (use_sysenter()) {                                            \
+            retval = sysenter_call(NUMBER, 0, 0, 0);                     \
+        } else {                                                         \
+            asm volatile("int $0x80"                                     \
+                         : "=a"(retval)                                  \
+                         : "a"(NUMBER)                                   \
+                         : "memory");                                    \
+        }                                                                \
+        retval;                                                          \
     })
 
-#define _syscall1(NUMBER, ARG1)               \
-    ({                                        \
-        int retval;                           \
-        asm volatile("int $0x80"              \
-                     : "=a"(retval)           \
-                     : "a"(NUMBER), "b"(ARG1) \
-                     : "memory");             \
-        retval;                               \
+#define _syscall1(NUMBER, ARG1)                                          \
+    ({                                                                   \
+        int retval;                                                      \
+        if (use_sysenter()) {                                            \
+            retval = sysenter_call(NUMBER, (uint32_t)(ARG1), 0, 0);      \
+        } else {                                                         \
+            asm volatile("int $0x80"                                     \
+                         : "=a"(retval)                                  \
+                         : "a"(NUMBER), "b"(ARG1)                        \
+                         : "memory");                                    \
+        }                                                                \
+        retval;                                                          \
     })
 
-#define _syscall2(NUMBER, ARG1, ARG2)                    \
-    ({                                                   \
-        int retval;                                      \
-        asm volatile("int $0x80"                         \
-                     : "=a"(retval)                      \
-                     : "a"(NUMBER), "b"(ARG1), "c"(ARG2) \
-                     : "memory");                        \
-        retval;                                          \
+#define _syscall2(NUMBER, ARG1, ARG2)                                    \
+    ({                                                                   \
+        int retval;                                                      \
+        if (use_sysenter()) {                                            \
+            retval = sysenter_call(NUMBER, (uint32_t)(ARG1),             \
+                                   (uint32_t)(ARG2), 0);                 \
+        } else {                                                         \
+            asm volatile("int $0x80"                                     \
+                         : "=a"(retval)                                  \
+                         : "a"(NUMBER), "b"(ARG1), "c"(ARG2)             \
+                         : "memory");                                    \
+        }                                                                \
+        retval;                                                          \
     })
 
-#define _syscall3(NUMBER, ARG1, ARG2, ARG3)                         \
-    ({                                                              \
-        int retval;                                                 \
-        asm volatile("int $0x80"                                    \
-                     : "=a"(retval)                                 \
-                     : "a"(NUMBER), "b"(ARG1), "c"(ARG2), "d"(ARG3) \
-                     : "memory");                                   \
-        retval;                                                     \
+#define _syscall3(NUMBER, ARG1, ARG2, ARG3)                              \
+    ({                                                                   \
+        int retval;                                                      \
+        if (use_sysenter()) {                                            \
+            retval = sysenter_call(NUMBER, (uint32_t)(ARG1),             \
+                                   (uint32_t)(ARG2), (uint32_t)(ARG3));  \
+        } else {                                                         \
+            asm volatile("int $0x80"                                     \
+                         : "=a"(retval)                                  \
+                         : "a"(NUMBER), "b"(ARG1), "c"(ARG2), "d"(ARG3)  \
+                         : "memory");                                    \
+        }                                                                \
+        retval;                                                          \
     })
 
+/* 用户进程直接读vdso, 不进内核 */
 uint32_t getpid() {
+    if (user_mode()) { return ((struct vdso_proc*)VDSO_PROC_VADDR)->pid; }
     return _syscall0(SYS_GETPID);
 }
 
@@ -136,3 +202,141 @@ int32_t chdir(const char* path) {
 void ps(void) {
     _syscall0(SYS_PS);
 }
+
+/* 设置pid的nice值, pid为0表示自己 */
+int32_t setpriority(pid_t pid, int32_t nice) {
+    return _syscall2(SYS_SETPRIORITY, pid, nice);
+}
+
+/* 返回20 - nice, 失败返回-1 */
+int32_t getpriority(pid_t pid) {
+    return _syscall1(SYS_GETPRIORITY, pid);
+}
+
+/* 把自己的nice值增加inc, 成功返回0, 失败返回-1 */
+int32_t nice(int32_t inc) {
+    int32_t prio = getpriority(0);
+    if (prio == -1) { return -1; }
+    return setpriority(0, 20 - prio + inc);
+}
+
+/* 设置pid的调度策略(见sched.h中的enum sched_policy)和实时优先级 */
+int32_t sched_setscheduler(pid_t pid, int32_t policy, int32_t rt_priority) {
+    return _syscall3(SYS_SCHED_SETSCHEDULER, pid, policy, rt_priority);
+}
+
+/* 获取pid的调度策略 */
+int32_t sched_getscheduler(pid_t pid) {
+    return _syscall1(SYS_SCHED_GETSCHEDULER, pid);
+}
+
+/* 睡眠req指定的时间, rem返回剩余的时间 */
+int32_t nanosleep(const struct timespec* req, struct timespec* rem) {
+    return _syscall2(SYS_NANOSLEEP, req, rem);
+}
+
+/* 睡眠seconds秒, 返回没睡完的秒数 */
+uint32_t sleep(uint32_t seconds) {
+    struct timespec req = {seconds, 0};
+    struct timespec rem = {0, 0};
+    nanosleep(&req, &rem);
+    return rem.tv_sec;
+}
+
+// 按seqlock的方式读vdso时钟页. 内核还没更新过时钟页返回-1, 改走系统调用
+static int32_t vdso_clock_gettime(int32_t clock_id, struct timespec* ts) {
+    const struct vdso_clock* vc = (const struct vdso_clock*)VDSO_CLOCK_VADDR;
+    uint32_t seq;
+    uint64_t ns;
+    do {
+        seq = vc->seq;
+        asm volatile("" : : : "memory");
+        if (clock_id == CLOCK_MONOTONIC) {
+            ns = mul_u64_u32_shr(rdtsc() - vc->tsc_boot, vc->tsc_mult,
+                                 vc->tsc_shift);
+        } else {
+            ns = vc->tick_ns;
+        }
+        asm volatile("" : : : "memory");
+    } while ((seq & 1) || seq != vc->seq);
+    if (seq == 0) { return -1; }
+    uint32_t nsec;
+    ts->tv_sec = (uint32_t)div_u64_rem(ns, NSEC_PER_SEC, &nsec);
+    ts->tv_nsec = nsec;
+    return 0;
+}
+
+/* 读取clock_id对应的时钟, 精度为纳秒 */
+int32_t clock_gettime(int32_t clock_id, struct timespec* ts) {
+    if (user_mode() && ts != NULL && (clock_id == CLOCK_MONOTONIC ||
+                                      clock_id == CLOCK_MONOTONIC_COARSE)) {
+        if (vdso_clock_gettime(clock_id, ts) == 0) { return 0; }
+    }
+    return _syscall2(SYS_CLOCK_GETTIME, clock_id, ts);
+}
+
+/* 跑一遍优先级反转的场景, 比较有无优先级继承时高优先级线程的等待时间 */
+int32_t pi_bench(struct pi_bench_result* res) {
+    return _syscall1(SYS_PI_BENCH, res);
+}
+
+/* futex操作, 见futex.h */
+int32_t futex(volatile uint32_t* uaddr, int32_t op, uint32_t val) {
+    return _syscall3(SYS_FUTEX, uaddr, op, val);
+}
+
+/* 在当前进程中创建共享地址空间的线程, 返回tid */
+pid_t clone(const struct clone_args* args) {
+    return _syscall1(SYS_CLONE, args);
+}
+
+/* 结束当前线程, 主线程不能调用 */
+void thread_exit(int32_t status) {
+    _syscall1(SYS_THREAD_EXIT, status);
+}
+
+/* 等待线程tid结束, 退出码存入status */
+int32_t thread_join(pid_t tid, int32_t* status) {
+    return _syscall2(SYS_THREAD_JOIN, tid, status);
+}
+
+/* 建立提交队列长度为entries的异步系统调用环, 返回共享页的地址 */
+struct io_ring* io_ring_setup(uint32_t entries) {
+    return (struct io_ring*)_syscall1(SYS_IO_RING_SETUP, entries);
+}
+
+/* 提交已放入环中的请求, 等到至少有min_complete个完成项 */
+int32_t io_ring_enter(uint32_t min_complete) {
+    return _syscall1(SYS_IO_RING_ENTER, min_complete);
+}
+
+/* 释放异步系统调用环 */
+int32_t io_ring_destroy() {
+    return _syscall0(SYS_IO_RING_DESTROY);
+}
+
+/* 结束当前进程, 进程中的其他线程一起结束 */
+void exit(int32_t status) {
+    _syscall1(SYS_EXIT, status);
+}
+
+/* 等待任一子进程退出, 退出码存入status, 返回子进程的pid */
+pid_t wait(int32_t* status) {
+    return _syscall1(SYS_WAIT, status);
+}
+
+/* 取调度统计和最多max_tasks个任务的统计, 返回填入的任务数 */
+int32_t getstats(struct sys_stat* sys, struct task_stat* tasks,
+                 uint32_t max_tasks) {
+    return _syscall3(SYS_GETSTATS, sys, tasks, max_tasks);
+}
+
+/* 比较pio和dma读sec_cnt个扇区的耗时 */
+int32_t ide_bench(uint32_t sec_cnt, struct ide_bench_result* res) {
+    return _syscall2(SYS_IDE_BENCH, sec_cnt, res);
+}
+
+/* 在sdc的48位lba扇区和最后一个扇区上写入再读回 */
+int32_t ide_check(struct ide_check_result* res) {
+    return _syscall1(SYS_IDE_CHECK, res);
+}
@@ -3,6 +3,11 @@
 
 #include "stdint.h"
 #include "thread.h"
+#include "timer.h"
+#include "sync.h"
+#include "clone.h"
+#include "io_ring.h"
+#include "ide.h"
 
 enum SYSCALL_NR {
     SYS_GETPID,
@@ -26,9 +31,29 @@ enum SYSCALL_NR {
     SYS_READDIR,
     SYS_REWINDDIR,
     SYS_STAT,
-    SYS_PS
+    SYS_PS,
+    SYS_SETPRIORITY,
+    SYS_GETPRIORITY,
+    SYS_SCHED_SETSCHEDULER,
+    SYS_SCHED_GETSCHEDULER,
+    SYS_NANOSLEEP,
+    SYS_CLOCK_GETTIME,
+    SYS_PI_BENCH,
+    SYS_FUTEX,
+    SYS_CLONE,
+    SYS_THREAD_EXIT,
+    SYS_THREAD_JOIN,
+    SYS_IO_RING_SETUP,
+    SYS_IO_RING_ENTER,
+    SYS_IO_RING_DESTROY,
+    SYS_EXIT,
+    SYS_WAIT,
+    SYS_GETSTATS,
+    SYS_IDE_BENCH,
+    SYS_IDE_CHECK
 };
 
+bool syscall_set_fast(bool enable);
 uint32_t getpid();
 uint32_t write(uint32_t fd, const void* buf, uint32_t count);
 void* malloc(uint32_t size);
@@ -37,5 +62,27 @@ pid_t fork();
 int32_t read(int32_t fd, void* buf, uint32_t count);
 void putchar(char char_asci);
 void clear();
+int32_t setpriority(pid_t pid, int32_t nice);
+int32_t getpriority(pid_t pid);
+int32_t nice(int32_t inc);
+int32_t sched_setscheduler(pid_t pid, int32_t policy, int32_t rt_priority);
+int32_t sched_getscheduler(pid_t pid);
+int32_t nanosleep(const struct timespec* req, struct timespec* rem);
+uint32_t sleep(uint32_t seconds);
+int32_t clock_gettime(int32_t clock_id, struct timespec* ts);
+int32_t pi_bench(struct pi_bench_result* res);
+int32_t futex(volatile uint32_t* uaddr, int32_t op, uint32_t val);
+pid_t clone(const struct clone_args* args);
+void thread_exit(int32_t status);
+int32_t thread_join(pid_t tid, int32_t* status);
+struct io_ring* io_ring_setup(uint32_t entries);
+int32_t io_ring_enter(uint32_t min_complete);
+int32_t io_ring_destroy(void);
+void exit(int32_t status);
+pid_t wait(int32_t* status);
+int32_t getstats(struct sys_stat* sys, struct task_stat* tasks,
+                 uint32_t max_tasks);
+int32_t ide_bench(uint32_t sec_cnt, struct ide_bench_result* res);
+int32_t ide_check(struct ide_check_result* res);
 
 #endif
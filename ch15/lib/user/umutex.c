@@ -0,0 +1,72 @@
+#include "umutex.h"
+#include "futex.h"
+#include "syscall.h"
+
+// *ptr等于old时写入new, 返回*ptr原来的值
+static inline uint32_t cmpxchg(volatile uint32_t* ptr, uint32_t old, uint32_t new) {
+    uint32_t prev;
+    asm volatile("lock cmpxchgl %2, %1"
+                 : "=a"(prev), "+m"(*ptr)
+                 : "r"(new), "0"(old)
+                 : "memory");
+    return prev;
+}
+
+// 把*ptr设为val, 返回原来的值
+static inline uint32_t xchg(volatile uint32_t* ptr, uint32_t val) {
+    asm volatile("xchgl %0, %1" : "+r"(val), "+m"(*ptr) : : "memory");
+    return val;
+}
+
+static inline void atomic_inc(volatile uint32_t* ptr) {
+    asm volatile("lock incl %0" : "+m"(*ptr) : : "memory");
+}
+
+void umutex_init(struct umutex* m) {
+    m->state = 0;
+}
+
+void umutex_lock(struct umutex* m) {
+    uint32_t state = cmpxchg(&m->state, 0, 1);
+    if (state == 0) { return; }  // 没有竞争, 直接拿到
+    // 有竞争, 标记为有人在等再睡眠. 醒来后仍按有人在等处理, 解锁时才会去唤醒
+    if (state != 2) { state = xchg(&m->state, 2); }
+    while (state != 0) {
+        futex(&m->state, FUTEX_WAIT, 2);
+        state = xchg(&m->state, 2);
+    }
+}
+
+// 拿到锁返回true, 否则立即返回false
+bool umutex_trylock(struct umutex* m) {
+    return cmpxchg(&m->state, 0, 1) == 0;
+}
+
+void umutex_unlock(struct umutex* m) {
+    // 原来是1说明没人等, 不用进内核
+    if (xchg(&m->state, 0) == 2) { futex(&m->state, FUTEX_WAKE, 1); }
+}
+
+void ucond_init(struct ucond* c) {
+    c->seq = 0;
+}
+
+// 释放m并等待通知, 返回前重新获取m. 可能被虚假唤醒, 调用者要循环检查条件
+void ucond_wait(struct ucond* c, struct umutex* m) {
+    uint32_t seq = c->seq;
+    umutex_unlock(m);
+    // 解锁后若已经有人signal, seq已变, FUTEX_WAIT会直接返回
+    futex(&c->seq, FUTEX_WAIT, seq);
+    // 醒来时可能还有别的等待者, 按有人在等的方式加锁, 保证解锁时会唤醒它们
+    while (xchg(&m->state, 2) != 0) { futex(&m->state, FUTEX_WAIT, 2); }
+}
+
+void ucond_signal(struct ucond* c) {
+    atomic_inc(&c->seq);
+    futex(&c->seq, FUTEX_WAKE, 1);
+}
+
+void ucond_broadcast(struct ucond* c) {
+    atomic_inc(&c->seq);
+    futex(&c->seq, FUTEX_WAKE, 0x7fffffff);
+}
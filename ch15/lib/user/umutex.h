@@ -0,0 +1,29 @@
+#ifndef __LIB_USER_UMUTEX_H
+#define __LIB_USER_UMUTEX_H
+
+#include "global.h"
+#include "stdint.h"
+
+// 用户态互斥锁. 没有竞争时加锁解锁只是一次原子操作, 不进内核
+struct umutex {
+    volatile uint32_t state;  // 0: 未加锁, 1: 已加锁, 2: 已加锁且可能有人在等
+};
+
+// 用户态条件变量, 与umutex配合使用
+struct ucond {
+    volatile uint32_t seq;  // 每次signal/broadcast加1, 等待者据此判断是否被通知过
+};
+
+#define UMUTEX_INITIALIZER {0}
+#define UCOND_INITIALIZER {0}
+
+void umutex_init(struct umutex* m);
+void umutex_lock(struct umutex* m);
+bool umutex_trylock(struct umutex* m);
+void umutex_unlock(struct umutex* m);
+void ucond_init(struct ucond* c);
+void ucond_wait(struct ucond* c, struct umutex* m);
+void ucond_signal(struct ucond* c);
+void ucond_broadcast(struct ucond* c);
+
+#endif
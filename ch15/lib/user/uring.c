@@ -0,0 +1,40 @@
+#include "uring.h"
+#include "syscall.h"
+
+// 往提交队列中放一个请求, 此时还不进内核. 队列满返回-1
+int32_t uring_queue(struct io_ring* ring,
+                    uint32_t opcode,
+                    int32_t fd,
+                    void* buf,
+                    uint32_t len,
+                    uint32_t user_data) {
+    uint32_t tail = ring->sq_tail;
+    if (tail - ring->sq_head == ring->sq_entries) { return -1; }
+    struct io_sqe* sqe = &ring->sqes[tail & (ring->sq_entries - 1)];
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->buf = buf;
+    sqe->len = len;
+    sqe->user_data = user_data;
+    asm volatile("" : : : "memory");  // 队列项写好后才能推进tail
+    ring->sq_tail = tail + 1;
+    return 0;
+}
+
+// 一次系统调用提交所有排队的请求, 等到至少有min_complete个完成项
+int32_t uring_submit(struct io_ring* ring UNUSED, uint32_t min_complete) {
+    return io_ring_enter(min_complete);
+}
+
+// 取最早的完成项, 没有返回NULL. 用完后调用uring_cqe_seen归还
+struct io_cqe* uring_peek_cqe(struct io_ring* ring) {
+    uint32_t head = ring->cq_head;
+    if (head == ring->cq_tail) { return NULL; }
+    asm volatile("" : : : "memory");
+    return &ring->cqes[head & (ring->cq_entries - 1)];
+}
+
+void uring_cqe_seen(struct io_ring* ring) {
+    asm volatile("" : : : "memory");  // 读完完成项才能归还给内核
+    ring->cq_head++;
+}
@@ -0,0 +1,18 @@
+#ifndef __LIB_USER_URING_H
+#define __LIB_USER_URING_H
+
+#include "global.h"
+#include "io_ring.h"
+#include "stdint.h"
+
+int32_t uring_queue(struct io_ring* ring,
+                    uint32_t opcode,
+                    int32_t fd,
+                    void* buf,
+                    uint32_t len,
+                    uint32_t user_data);
+int32_t uring_submit(struct io_ring* ring, uint32_t min_complete);
+struct io_cqe* uring_peek_cqe(struct io_ring* ring);
+void uring_cqe_seen(struct io_ring* ring);
+
+#endif
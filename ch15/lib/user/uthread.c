@@ -0,0 +1,44 @@
+#include "uthread.h"
+#include "syscall.h"
+
+// 新线程从这里开始执行, func返回后结束线程
+static void uthread_start(void* arg) {
+    struct uthread* thread = arg;
+    thread->func(thread->arg);
+    thread_exit(0);
+}
+
+// 创建线程执行func(arg), 失败返回NULL
+struct uthread* uthread_create(void (*func)(void*), void* arg) {
+    struct uthread* thread = malloc(UTHREAD_STACK_SIZE);
+    if (thread == NULL) { return NULL; }
+    thread->self = thread;
+    thread->func = func;
+    thread->arg = arg;
+
+    struct clone_args args;
+    args.func = uthread_start;
+    args.arg = thread;
+    args.stack_top = (uint8_t*)thread + UTHREAD_STACK_SIZE;
+    args.tls = thread;
+    thread->tid = clone(&args);
+    if (thread->tid == -1) {
+        free(thread);
+        return NULL;
+    }
+    return thread;
+}
+
+// 等待线程结束并释放它的栈, 退出码存入status
+int32_t uthread_join(struct uthread* thread, int32_t* status) {
+    if (thread_join(thread->tid, status) == -1) { return -1; }
+    free(thread);
+    return 0;
+}
+
+// 当前线程. 只能在uthread_create创建的线程中调用, 主线程没有tls
+struct uthread* uthread_self() {
+    struct uthread* self;
+    asm volatile("movl %%gs:0, %0" : "=r"(self));
+    return self;
+}
@@ -0,0 +1,21 @@
+#ifndef __LIB_USER_UTHREAD_H
+#define __LIB_USER_UTHREAD_H
+
+#include "stdint.h"
+#include "thread.h"
+
+#define UTHREAD_STACK_SIZE 8192  // 每个线程的用户栈大小
+
+// 用户线程. 放在线程栈所在内存块的开头, 同时作为线程的tls
+struct uthread {
+    struct uthread* self;  // 必须是第一个成员, uthread_self通过gs:0读取
+    pid_t tid;
+    void (*func)(void* arg);
+    void* arg;
+};
+
+struct uthread* uthread_create(void (*func)(void*), void* arg);
+int32_t uthread_join(struct uthread* thread, int32_t* status);
+struct uthread* uthread_self(void);
+
+#endif
@@ -266,3 +266,236 @@ int32_t builtin_rm(uint32_t argc, char** argv) {
     }
     return ret;
 }
+
+/* pibench命令内建函数: 低, 中, 高优先级线程的优先级反转场景,
+   比较有无优先级继承时高优先级线程等锁的时间 */
+void builtin_pibench(uint32_t argc, char** argv UNUSED) {
+    if (argc != 1) {
+        printf("pibench: no argument support!\n");
+        return;
+    }
+    struct pi_bench_result res;
+    if (pi_bench(&res) == -1) {
+        printf("pibench: another pibench is running\n");
+        return;
+    }
+    printf("low holds the mutex for %d us, medium spins for %d us\n",
+           res.hold_us, res.medium_us);
+    printf("lock, priority inheritance: high waited %d us\n",
+           res.lock_wait_us);
+    printf("semaphore, no inheritance: high waited %d us\n",
+           res.sema_wait_us);
+}
+
+#define SYSBENCH_LOOPS 10000
+
+static uint32_t sysbench_elapsed_ns(const struct timespec* start,
+                                    const struct timespec* end) {
+    return (end->tv_sec - start->tv_sec) * NSEC_PER_SEC + end->tv_nsec -
+           start->tv_nsec;
+}
+
+// 连续做最简单的系统调用, 返回平均每次的纳秒数
+static uint32_t sysbench_syscall() {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint32_t i;
+    for (i = 0; i < SYSBENCH_LOOPS; i++) { sched_getscheduler(0); }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return sysbench_elapsed_ns(&start, &end) / SYSBENCH_LOOPS;
+}
+
+// getpid读vdso, 不进内核
+static uint32_t sysbench_vdso() {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint32_t i;
+    for (i = 0; i < SYSBENCH_LOOPS; i++) { getpid(); }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return sysbench_elapsed_ns(&start, &end) / SYSBENCH_LOOPS;
+}
+
+// 比较int 0x80, sysenter和vdso三种方式的系统调用延迟
+void builtin_sysbench(uint32_t argc, char** argv UNUSED) {
+    if (argc != 1) {
+        printf("sysbench: no argument support!\n");
+        return;
+    }
+    syscall_set_fast(false);
+    printf("int 0x80: %d ns/call\n", sysbench_syscall());
+    if (syscall_set_fast(true)) {
+        printf("sysenter: %d ns/call\n", sysbench_syscall());
+    } else {
+        printf("sysenter: not supported\n");
+    }
+    printf("vdso getpid: %d ns/call\n", sysbench_vdso());
+}
+
+#define TOP_MAX_TASKS 32
+
+/* 输出str, 不足width个字符时用空格补齐 */
+static void print_col(const char* str, uint32_t width) {
+    uint32_t len = strlen(str);
+    printf("%s", str);
+    while (len++ < width) { putchar(' '); }
+}
+
+static void print_num_col(uint32_t num, uint32_t width) {
+    char buf[12];
+    sprintf(buf, "%d", num);
+    print_col(buf, width);
+}
+
+/* 上一次快照中pid的运行时间, 新出现的任务返回0 */
+static uint32_t prev_run_ms(struct task_stat* prev, int32_t prev_cnt,
+                            pid_t pid) {
+    int32_t i;
+    for (i = 0; i < prev_cnt; i++) {
+        if (prev[i].pid == pid) { return prev[i].run_ms; }
+    }
+    return 0;
+}
+
+/* 打印一屏统计, 比率按与上一次快照的差值计算 */
+static void top_show(struct sys_stat* sys, struct sys_stat* prev_sys,
+                     struct task_stat* tasks, int32_t cnt,
+                     struct task_stat* prev, int32_t prev_cnt) {
+    static const char* stat_name[] = {"RUN", "READY", "BLOCK",
+                                      "WAIT", "HANG", "DIED"};
+    uint32_t elapsed = sys->uptime_ms - prev_sys->uptime_ms;
+    if (elapsed == 0) { elapsed = 1; }
+    uint32_t idle = (sys->idle_ms - prev_sys->idle_ms) * 100 / elapsed;
+    printf("tasks: %d  runnable: %d  switches/s: %d  idle: %d%c\n",
+           sys->nr_tasks, sys->nr_running,
+           (sys->nr_switches - prev_sys->nr_switches) * 1000 / elapsed,
+           idle > 100 ? 100 : idle, '%');
+    // printf不支持%%, 百分号用%c输出
+    printf("PID   TGID  STATE  CPU%c  RUN(ms)  WAIT(ms) BLOCK(ms) "
+           "VCSW   IVCSW  NAME\n", '%');
+    int32_t i;
+    for (i = 0; i < cnt; i++) {
+        struct task_stat* st = &tasks[i];
+        uint32_t cpu = (st->run_ms - prev_run_ms(prev, prev_cnt, st->pid)) *
+                       100 / elapsed;
+        print_num_col(st->pid, 6);
+        print_num_col(st->tgid, 6);
+        print_col(st->status <= TASK_DIED ? stat_name[st->status] : "?", 7);
+        print_num_col(cpu > 100 ? 100 : cpu, 6);
+        print_num_col(st->run_ms, 9);
+        print_num_col(st->wait_ms, 9);
+        print_num_col(st->block_ms, 10);
+        print_num_col(st->nvcsw, 7);
+        print_num_col(st->nivcsw, 7);
+        printf("%s\n", st->name);
+    }
+}
+
+/* 把十进制字符串str转成正整数存入num, 不是正整数时返回false */
+static bool parse_count(const char* str, uint32_t* num) {
+    *num = 0;
+    while (*str >= '0' && *str <= '9') { *num = *num * 10 + (*str++ - '0'); }
+    return *str == 0 && *num != 0;
+}
+
+/* top命令内建函数: top [n], 每秒刷新一次调度统计, 共n次(默认5次) */
+void builtin_top(uint32_t argc, char** argv) {
+    uint32_t rounds = 5;
+    if (argc > 2) {
+        printf("top: only support 1 argument!\n");
+        return;
+    }
+    if (argc == 2 && !parse_count(argv[1], &rounds)) {
+        printf("top: invalid count %s\n", argv[1]);
+        return;
+    }
+    struct task_stat* cur = malloc(sizeof(struct task_stat) * TOP_MAX_TASKS);
+    struct task_stat* prev = malloc(sizeof(struct task_stat) * TOP_MAX_TASKS);
+    if (cur == NULL || prev == NULL) {
+        printf("top: malloc failed\n");
+        if (cur != NULL) { free(cur); }
+        if (prev != NULL) { free(prev); }
+        return;
+    }
+    struct sys_stat sys, prev_sys;
+    // 第一次快照只作为计算比率的起点
+    int32_t prev_cnt = getstats(&prev_sys, prev, TOP_MAX_TASKS);
+    while (rounds-- > 0) {
+        sleep(1);
+        int32_t cnt = getstats(&sys, cur, TOP_MAX_TASKS);
+        clear();
+        top_show(&sys, &prev_sys, cur, cnt, prev, prev_cnt);
+        struct task_stat* tmp = prev;
+        prev = cur;
+        cur = tmp;
+        prev_sys = sys;
+        prev_cnt = cnt;
+    }
+    free(cur);
+    free(prev);
+}
+
+/* 读了sec_cnt个扇区用时us微秒, 换算成KB/s */
+static uint32_t kb_per_sec(uint32_t sec_cnt, uint32_t us) {
+    if (us == 0) { us = 1; }
+    return sec_cnt / 2 * 1000000 / us;  // sec_cnt不超过2048, 不会溢出
+}
+
+/* diskbench命令内建函数: diskbench [扇区数], 比较pio和dma的读速度 */
+void builtin_diskbench(uint32_t argc, char** argv) {
+    uint32_t sec_cnt = 1024;
+    if (argc > 2) {
+        printf("diskbench: only support 1 argument!\n");
+        return;
+    }
+    if (argc == 2 && !parse_count(argv[1], &sec_cnt)) {
+        printf("diskbench: invalid sector count %s\n", argv[1]);
+        return;
+    }
+    struct ide_bench_result res;
+    if (ide_bench(sec_cnt, &res) == -1) {
+        printf("diskbench: at most %d sectors\n", IDE_BENCH_MAX_SECS);
+        return;
+    }
+    printf("read %d sectors, pio multiple mode: %d sectors/block\n",
+           res.sec_cnt, res.multi_secs);
+    printf("pio: %d us, %d KB/s, %d interrupts, %d sectors/interrupt\n",
+           res.pio_us, kb_per_sec(res.sec_cnt, res.pio_us), res.pio_intrs,
+           res.sec_cnt / (res.pio_intrs ? res.pio_intrs : 1));
+    if (res.dma_us == 0) {
+        printf("dma: not supported\n");
+    } else {
+        printf("dma: %d us, %d KB/s, %d interrupts, %d sectors/interrupt\n",
+               res.dma_us, kb_per_sec(res.sec_cnt, res.dma_us), res.dma_intrs,
+               res.sec_cnt / (res.dma_intrs ? res.dma_intrs : 1));
+    }
+}
+
+static const char* check_status_str(uint32_t status) {
+    switch (status) {
+        case IDE_CHECK_OK: return "ok";
+        case IDE_CHECK_SKIPPED: return "skipped";
+        case IDE_CHECK_IO_ERROR: return "io error";
+        case IDE_CHECK_MISMATCH: return "mismatch";
+        case IDE_CHECK_ALIASED: return "aliased to a truncated lba";
+        default: return "unknown";
+    }
+}
+
+/* lba48test命令内建函数: 在sdc上用pio和dma写入再读回48位lba的扇区 */
+void builtin_lba48test(uint32_t argc, char** argv UNUSED) {
+    if (argc != 1) {
+        printf("lba48test: no argument support!\n");
+        return;
+    }
+    struct ide_check_result res;
+    if (ide_check(&res) == -1) {
+        printf("lba48test: no sdc, run with make qemu_bigdisk\n");
+        return;
+    }
+    printf("sdc: 0x%x sectors\n", res.sectors);
+    uint32_t i;
+    for (i = 0; i < IDE_CHECK_LBAS; i++) {
+        printf("lba 0x%x: pio %s, dma %s\n", res.lba[i],
+               check_status_str(res.pio[i]), check_status_str(res.dma[i]));
+    }
+}
@@ -12,5 +12,10 @@ int32_t builtin_rm(uint32_t argc, char** argv);
 void builtin_pwd(uint32_t argc, char** argv);
 void builtin_ps(uint32_t argc, char** argv);
 void builtin_clear(uint32_t argc, char** argv);
+void builtin_pibench(uint32_t argc, char** argv);
+void builtin_sysbench(uint32_t argc, char** argv);
+void builtin_top(uint32_t argc, char** argv);
+void builtin_diskbench(uint32_t argc, char** argv);
+void builtin_lba48test(uint32_t argc, char** argv);
 
 #endif
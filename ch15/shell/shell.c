@@ -1,6 +1,7 @@
 #include "shell.h"
 
 #include "assert.h"
+#include "builtin_cmd.h"
 #include "file.h"
 #include "fs.h"
 #include "global.h"
@@ -131,6 +132,12 @@ void my_shell() {
       builtin_pwd(argc, argv);
     } else if (!strcmp("ps", argv[0])) {
       builtin_ps(argc, argv);
+    } else if (!strcmp("top", argv[0])) {
+      builtin_top(argc, argv);
+    } else if (!strcmp("diskbench", argv[0])) {
+      builtin_diskbench(argc, argv);
+    } else if (!strcmp("lba48test", argv[0])) {
+      builtin_lba48test(argc, argv);
     } else if (!strcmp("clear", argv[0])) {
       builtin_clear(argc, argv);
     } else if (!strcmp("mkdir", argv[0])) {
@@ -139,13 +146,17 @@ void my_shell() {
       builtin_rmdir(argc, argv);
     } else if (!strcmp("rm", argv[0])) {
       builtin_rm(argc, argv);
+    } else if (!strcmp("pibench", argv[0])) {
+      builtin_pibench(argc, argv);
+    } else if (!strcmp("sysbench", argv[0])) {
+      builtin_sysbench(argc, argv);
     } else {  // 如果是外部命令,需要从磁盘上加载
       int32_t pid = fork();
       if (pid) {  // 父进程
-        /* 下面这个while必须要加上,否则父进程一般情况下会比子进程先执行,
+        /* 必须等子进程结束,否则父进程一般情况下会比子进程先执行,
             因此会进行下一轮循环将findl_path清空,这样子进程将无法从final_path中获得参数*/
-        while (1)
-          ;
+        int32_t status;
+        wait(&status);
       } else {  // 子进程
         make_clear_abs_path(argv[0], final_path);
         argv[0] = final_path;
@@ -160,8 +171,7 @@ void my_shell() {
         } else {
           execv(argv[0], argv);
         }
-        while (1)
-          ;
+        exit(-1);  // execv成功不会回到这里
       }
     }
     int32_t arg_idx = 0;
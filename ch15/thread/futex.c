@@ -0,0 +1,106 @@
+#include "futex.h"
+#include "debug.h"
+#include "global.h"
+#include "interrupt.h"
+#include "list.h"
+#include "memory.h"
+#include "thread.h"
+
+// 在futex上睡眠的任务, 放在睡眠任务自己的内核栈上
+struct futex_q {
+    struct list_elem tag;         // 用于哈希桶中的结点
+    uint32_t key;                 // futex的物理地址
+    struct task_struct* waiter;
+};
+
+// 以物理地址为key, 这样映射同一物理页的不同进程(比如共享地址空间的线程)
+// 能在同一个futex上同步
+static struct list futex_hash[FUTEX_HASH_SIZE];
+
+static struct list* futex_bucket(uint32_t key) {
+    return &futex_hash[(key >> 2) % FUTEX_HASH_SIZE];
+}
+
+// 检查uaddr并换算成物理地址, 非法返回0. 必须在关中断时调用, 保证页表不变
+static uint32_t futex_key(uint32_t* uaddr) {
+    uint32_t vaddr = (uint32_t)uaddr;
+    if (vaddr == 0 || (vaddr & 3) != 0) { return 0; }
+    // 用户进程只能用用户空间的地址
+    if (running_thread()->pgdir != NULL && vaddr >= 0xc0000000) { return 0; }
+    if (!(*pde_ptr(vaddr) & PG_P_1) || !(*pte_ptr(vaddr) & PG_P_1)) { return 0; }
+    return addr_v2p(vaddr);
+}
+
+// 关中断后比较*uaddr和val, 与FUTEX_WAKE互斥, 所以不会丢失唤醒
+static int32_t futex_wait(uint32_t* uaddr, uint32_t val) {
+    enum intr_status old_status = intr_disable();
+    uint32_t key = futex_key(uaddr);
+    if (key == 0 || *uaddr != val) {
+        intr_set_status(old_status);
+        return -1;
+    }
+    struct futex_q q;
+    q.key = key;
+    q.waiter = running_thread();
+    list_append(futex_bucket(key), &q.tag);
+    thread_block(TASK_BLOCKED);
+    intr_set_status(old_status);
+    return 0;
+}
+
+// 返回唤醒的任务数
+static int32_t futex_wake(uint32_t* uaddr, uint32_t nr_wake) {
+    enum intr_status old_status = intr_disable();
+    uint32_t key = futex_key(uaddr);
+    if (key == 0) {
+        intr_set_status(old_status);
+        return -1;
+    }
+    struct list* bucket = futex_bucket(key);
+    struct list_elem* elem = bucket->head.next;
+    int32_t woken = 0;
+    while (elem != &bucket->tail && (uint32_t)woken < nr_wake) {
+        struct futex_q* q = elem2entry(struct futex_q, tag, elem);
+        elem = elem->next;
+        if (q->key == key) {
+            list_remove(&q->tag);
+            thread_unblock(q->waiter);
+            woken++;
+        }
+    }
+    intr_set_status(old_status);
+    return woken;
+}
+
+// 成功时FUTEX_WAIT返回0, FUTEX_WAKE返回唤醒的任务数. 失败返回-1
+int32_t sys_futex(uint32_t* uaddr, int32_t op, uint32_t val) {
+    switch (op) {
+        case FUTEX_WAIT: return futex_wait(uaddr, val);
+        case FUTEX_WAKE: return futex_wake(uaddr, val);
+        default: return -1;
+    }
+}
+
+// 进程退出时唤醒组内所有在futex上睡眠的线程, 让它们回到用户态前结束
+void futex_wake_group(struct task_struct* leader) {
+    enum intr_status old_status = intr_disable();
+    uint32_t idx;
+    for (idx = 0; idx < FUTEX_HASH_SIZE; idx++) {
+        struct list* bucket = &futex_hash[idx];
+        struct list_elem* elem = bucket->head.next;
+        while (elem != &bucket->tail) {
+            struct futex_q* q = elem2entry(struct futex_q, tag, elem);
+            elem = elem->next;
+            if (q->waiter->group_leader == leader) {
+                list_remove(&q->tag);
+                thread_unblock(q->waiter);
+            }
+        }
+    }
+    intr_set_status(old_status);
+}
+
+void futex_init() {
+    uint32_t idx;
+    for (idx = 0; idx < FUTEX_HASH_SIZE; idx++) { list_init(&futex_hash[idx]); }
+}
@@ -0,0 +1,18 @@
+#ifndef __THREAD_FUTEX_H
+#define __THREAD_FUTEX_H
+
+#include "stdint.h"
+
+// futex操作
+#define FUTEX_WAIT 0  // *uaddr等于val时睡眠, 直到被FUTEX_WAKE唤醒
+#define FUTEX_WAKE 1  // 唤醒最多val个在uaddr上睡眠的任务
+
+#define FUTEX_HASH_SIZE 64  // 等待队列哈希表的桶数
+
+struct task_struct;
+
+int32_t sys_futex(uint32_t* uaddr, int32_t op, uint32_t val);
+void futex_wake_group(struct task_struct* leader);
+void futex_init(void);
+
+#endif
@@ -0,0 +1,473 @@
+#include "sched.h"
+#include "debug.h"
+#include "global.h"
+#include "interrupt.h"
+#include "list.h"
+#include "sync.h"
+#include "stdint.h"
+#include "thread.h"
+#include "timer.h"
+
+// 与linux的sched_prio_to_weight相同, 相邻nice值的cpu份额相差约10%
+static const uint32_t nice_weight_table[NICE_MAX - NICE_MIN + 1] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */ 9548,  7620,  6100,  4904,  3906,
+    /*  -5 */ 3121,  2501,  1991,  1586,  1277,
+    /*   0 */ 1024,  820,   655,   526,   423,
+    /*   5 */ 335,   272,   215,   172,   137,
+    /*  10 */ 110,   87,    70,    56,    45,
+    /*  15 */ 36,    29,    23,    18,    15,
+};
+
+// 普通任务的就绪队列: 以vruntime为key的小根堆, 堆顶是最"欠"cpu的任务
+// 任务的rq_idx记录自己在堆中的下标, 不在堆中时为RQ_NONE
+static struct task_struct* ready_heap[MAX_READY_TASKS];
+static uint32_t ready_cnt;
+
+// 单调递增, 所有就绪/运行任务vruntime的下界, 用于安置新任务和被唤醒的任务
+static uint32_t min_vruntime;
+
+// 实时任务的就绪队列: 每个优先级一个链表(通过general_tag串起来),
+// rt_bitmap第i位为1表示优先级i的链表非空, 这样找最高优先级是O(1)的
+static struct list rt_queue[RT_PRIO_MAX];
+static uint32_t rt_bitmap;
+static uint32_t rt_cnt;  // 就绪的实时任务数
+
+static uint32_t rt_period_ticks;  // 当前带宽周期已过去的tick
+static uint32_t rt_ticks_used;    // 当前周期内实时任务已运行的tick
+static bool rt_throttled;         // 实时任务本周期的额度已用完
+
+// 有更高优先级的任务就绪, 需要尽快重新调度
+static bool need_resched;
+
+// vruntime是32位的, 会回绕, 所以用有符号的差值比较先后
+#define vruntime_before(a, b) ((int32_t)((a) - (b)) < 0)
+
+uint32_t nice_to_weight(int8_t nice) {
+    ASSERT(nice >= NICE_MIN && nice <= NICE_MAX);
+    return nice_weight_table[nice - NICE_MIN];
+}
+
+uint32_t sched_min_vruntime() {
+    return min_vruntime;
+}
+
+static void heap_set(uint32_t idx, struct task_struct* pthread) {
+    ready_heap[idx] = pthread;
+    pthread->rq_idx = idx;
+}
+
+// idx处的任务向上调整
+static void sift_up(uint32_t idx) {
+    struct task_struct* pthread = ready_heap[idx];
+    while (idx > 0) {
+        uint32_t parent = (idx - 1) / 2;
+        if (!vruntime_before(pthread->vruntime, ready_heap[parent]->vruntime)) {
+            break;
+        }
+        heap_set(idx, ready_heap[parent]);
+        idx = parent;
+    }
+    heap_set(idx, pthread);
+}
+
+// idx处的任务向下调整
+static void sift_down(uint32_t idx) {
+    struct task_struct* pthread = ready_heap[idx];
+    while (true) {
+        uint32_t child = idx * 2 + 1;
+        if (child >= ready_cnt) { break; }
+        if (child + 1 < ready_cnt &&
+            vruntime_before(ready_heap[child + 1]->vruntime,
+                            ready_heap[child]->vruntime)) {
+            child++;
+        }
+        if (!vruntime_before(ready_heap[child]->vruntime, pthread->vruntime)) {
+            break;
+        }
+        heap_set(idx, ready_heap[child]);
+        idx = child;
+    }
+    heap_set(idx, pthread);
+}
+
+// min_vruntime = max(min_vruntime, min(当前任务, 堆顶任务))
+static void update_min_vruntime(struct task_struct* cur) {
+    bool found = false;
+    uint32_t vruntime = 0;
+    if (cur != NULL && cur->status == TASK_RUNNING) {
+        vruntime = cur->vruntime;
+        found = true;
+    }
+    if (ready_cnt > 0) {
+        uint32_t leftmost = ready_heap[0]->vruntime;
+        if (!found || vruntime_before(leftmost, vruntime)) {
+            vruntime = leftmost;
+        }
+        found = true;
+    }
+    if (found && vruntime_before(min_vruntime, vruntime)) {
+        min_vruntime = vruntime;
+    }
+}
+
+static bool is_rt(struct task_struct* pthread) {
+    return pthread->policy != SCHED_NORMAL;
+}
+
+// 最高的非空实时优先级, 没有实时任务就绪时返回0
+static uint32_t rt_highest_prio() {
+    uint32_t prio = 0;
+    if (rt_bitmap != 0) { asm("bsrl %1, %0" : "=r"(prio) : "rm"(rt_bitmap)); }
+    return prio;
+}
+
+static void rt_enqueue(struct task_struct* pthread, bool head) {
+    struct list* queue = &rt_queue[pthread->rt_priority];
+    if (head) {
+        list_push(queue, &pthread->general_tag);
+    } else {
+        list_append(queue, &pthread->general_tag);
+    }
+    rt_bitmap |= (1 << pthread->rt_priority);
+    rt_cnt++;
+    pthread->rq_idx = RQ_RT;
+}
+
+static void rt_dequeue(struct task_struct* pthread) {
+    list_remove(&pthread->general_tag);
+    if (list_empty(&rt_queue[pthread->rt_priority])) {
+        rt_bitmap &= ~(1 << pthread->rt_priority);
+    }
+    rt_cnt--;
+    pthread->rq_idx = RQ_NONE;
+}
+
+// 判断就绪的pthread是否应当抢占正在运行的cur
+static bool should_preempt(struct task_struct* pthread,
+                           struct task_struct* cur) {
+    if (!is_rt(pthread) || pthread == cur) { return false; }
+    return !is_rt(cur) || pthread->rt_priority > cur->rt_priority;
+}
+
+// 把任务放入就绪队列, 实时任务排在对应优先级链表的队尾
+void sched_enqueue(struct task_struct* pthread) {
+    enum intr_status old_status = intr_disable();
+    ASSERT(pthread->rq_idx == RQ_NONE);
+    tick_nohz_exit();  // 不再只有一个可运行的任务, 恢复周期时钟
+    if (is_rt(pthread)) {
+        rt_enqueue(pthread, false);
+        if (should_preempt(pthread, running_thread())) { need_resched = true; }
+        intr_set_status(old_status);
+        return;
+    }
+    if (ready_cnt >= MAX_READY_TASKS) { PANIC("sched_enqueue: too many tasks"); }
+
+    // 睡眠或新建的任务vruntime可能远远落后, 最多补偿SCHED_WAKEUP_CREDIT,
+    // 否则它会一直霸占cpu直到追上其他任务
+    uint32_t floor = min_vruntime - SCHED_WAKEUP_CREDIT;
+    if (vruntime_before(pthread->vruntime, floor)) {
+        pthread->vruntime = floor;
+    }
+
+    heap_set(ready_cnt, pthread);
+    ready_cnt++;
+    sift_up(ready_cnt - 1);
+    intr_set_status(old_status);
+}
+
+// 把任务从就绪队列中摘下
+void sched_dequeue(struct task_struct* pthread) {
+    enum intr_status old_status = intr_disable();
+    if (pthread->rq_idx == RQ_RT) {
+        rt_dequeue(pthread);
+        intr_set_status(old_status);
+        return;
+    }
+    ASSERT(pthread->rq_idx >= 0 && (uint32_t)pthread->rq_idx < ready_cnt);
+    ASSERT(ready_heap[pthread->rq_idx] == pthread);
+    uint32_t idx = pthread->rq_idx;
+    ready_cnt--;
+    if (idx != ready_cnt) {  // 用最后一个任务填补空位, 再调整
+        struct task_struct* last = ready_heap[ready_cnt];
+        heap_set(idx, last);
+        sift_up(idx);
+        sift_down(last->rq_idx);
+    }
+    pthread->rq_idx = RQ_NONE;
+    intr_set_status(old_status);
+}
+
+// 选出下一个运行的任务, 调用前就绪队列不能为空.
+// 实时任务优先, 除非实时任务被限流且有普通任务可以运行
+struct task_struct* sched_pick_next() {
+    ASSERT(intr_get_status() == INTR_OFF);
+    ASSERT(!sched_ready_empty());
+    struct task_struct* next;
+    need_resched = false;
+    if (rt_bitmap != 0 && (!rt_throttled || ready_cnt == 0)) {
+        struct list_elem* tag = rt_queue[rt_highest_prio()].head.next;
+        next = elem2entry(struct task_struct, general_tag, tag);
+        rt_dequeue(next);
+        return next;
+    }
+    next = ready_heap[0];
+    sched_dequeue(next);
+    update_min_vruntime(NULL);
+    return next;
+}
+
+bool sched_ready_empty() {
+    return ready_cnt == 0 && rt_bitmap == 0;
+}
+
+// 就绪的任务数, 不含正在运行的任务
+uint32_t sched_nr_ready() {
+    return ready_cnt + rt_cnt;
+}
+
+bool sched_need_resched() {
+    return need_resched;
+}
+
+// 中断处理程序中要求调度, 由irq_exit在处理完软中断之后进行
+void sched_set_need_resched() {
+    need_resched = true;
+}
+
+// schedule时当前任务仍可运行, 把它放回就绪队列
+void sched_put_prev(struct task_struct* cur) {
+    if (!is_rt(cur)) {
+        cur->ticks = cur->priority;  // 时间片充满
+        sched_enqueue(cur);
+    } else if (cur->policy == SCHED_RR && cur->ticks == 0) {
+        cur->ticks = RT_RR_TIMESLICE;  // 时间片用完, 排到同优先级的队尾
+        rt_enqueue(cur, false);
+    } else {
+        rt_enqueue(cur, true);  // 被抢占的实时任务仍排在同优先级的队首
+    }
+}
+
+// 主动让出cpu的任务排到堆顶任务之后, 否则它的vruntime若最小会立刻被再次选中.
+// 实时任务由sched_enqueue排到队尾, 不需要处理
+void sched_yield_place(struct task_struct* cur) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    if (!is_rt(cur) && ready_cnt > 0 &&
+        !vruntime_before(ready_heap[0]->vruntime, cur->vruntime)) {
+        cur->vruntime = ready_heap[0]->vruntime + 1;
+    }
+}
+
+// 时钟中断中调用, 处理时间片和实时带宽, 按权重累加普通任务的vruntime.
+// 返回true表示应当调度
+bool sched_tick(struct task_struct* cur) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    bool resched = need_resched;
+
+    // 新的带宽周期, 解除限流
+    if (++rt_period_ticks >= RT_PERIOD) {
+        rt_period_ticks = 0;
+        rt_ticks_used = 0;
+        if (rt_throttled) {
+            rt_throttled = false;
+            if (rt_bitmap != 0 && !is_rt(cur)) { resched = true; }
+        }
+    }
+
+    if (is_rt(cur)) {
+        // 额度用完且有普通任务在等, 限流到本周期结束
+        if (++rt_ticks_used >= RT_RUNTIME && !rt_throttled && ready_cnt > 0) {
+            rt_throttled = true;
+            resched = true;
+        }
+        if (cur->policy == SCHED_RR) {
+            if (cur->ticks == 0) {
+                resched = true;
+            } else {
+                cur->ticks--;
+            }
+        }
+        return resched;
+    }
+
+    cur->vruntime += VRUNTIME_PER_TICK * NICE_0_WEIGHT / cur->weight;
+    update_min_vruntime(cur);
+    if (cur->ticks == 0) {  // 时间片用完
+        resched = true;
+    } else {
+        cur->ticks--;
+    }
+    // 有未被限流的实时任务, 或者堆顶任务落后当前任务超过一个粒度, 就让出cpu
+    if (rt_bitmap != 0 && !rt_throttled) { resched = true; }
+    if (ready_cnt > 0 &&
+        vruntime_before(ready_heap[0]->vruntime + SCHED_WAKEUP_GRAN,
+                        cur->vruntime)) {
+        resched = true;
+    }
+    return resched;
+}
+
+// 把调度参数折算成一个可比较的优先级, 越大越优先. 实时任务总是高于普通任务
+static int32_t prio_key(uint8_t policy, uint8_t rt_priority, int8_t nice) {
+    if (policy != SCHED_NORMAL) { return NICE_MAX - NICE_MIN + 1 + rt_priority; }
+    return NICE_MAX - nice;
+}
+
+// 任务当前生效的优先级
+int32_t sched_prio(struct task_struct* pthread) {
+    return prio_key(pthread->policy, pthread->rt_priority, pthread->nice);
+}
+
+// 修改任务生效的调度参数
+static void sched_set_effective(struct task_struct* pthread,
+                                uint8_t policy,
+                                uint8_t rt_priority,
+                                int8_t nice) {
+    if (pthread->policy == policy && pthread->rt_priority == rt_priority &&
+        pthread->nice == nice) {
+        return;
+    }
+    // 在就绪队列中的任务要先摘下, 换了队列后再放回去
+    bool queued = (pthread->rq_idx != RQ_NONE);
+    if (queued) { sched_dequeue(pthread); }
+    uint8_t old_policy = pthread->policy;
+    pthread->policy = policy;
+    pthread->rt_priority = rt_priority;
+    pthread->nice = nice;
+    pthread->weight = nice_to_weight(nice);
+    if (policy != old_policy) {
+        if (policy == SCHED_RR) {
+            pthread->ticks = RT_RR_TIMESLICE;
+        } else if (policy == SCHED_NORMAL) {
+            pthread->ticks = pthread->priority;
+            // 当实时任务时没有累加vruntime, 回到公平调度时从min_vruntime开始
+            if (vruntime_before(pthread->vruntime, min_vruntime)) {
+                pthread->vruntime = min_vruntime;
+            }
+        }
+    }
+    if (queued) { sched_enqueue(pthread); }
+    // 正在运行的任务可能被降级了, 下个tick重新选择
+    if (pthread == running_thread()) { need_resched = true; }
+}
+
+#define PI_MAX_DEPTH 16  // 沿锁链传递优先级的最大深度, 防止死锁成环时无限循环
+
+// donor等待holder持有的锁, holder及其所等锁的持有者依次继承donor的优先级
+void sched_pi_boost(struct task_struct* holder, struct task_struct* donor) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    uint32_t depth = 0;
+    while (holder != NULL && depth++ < PI_MAX_DEPTH &&
+           sched_prio(donor) > sched_prio(holder)) {
+        sched_set_effective(holder, donor->policy, donor->rt_priority,
+                            donor->nice);
+        if (holder->blocked_on == NULL) { break; }
+        holder = holder->blocked_on->holder;
+    }
+}
+
+// 按任务自己的设置和所持有锁上的等待者, 重新计算生效的优先级.
+// 优先级变了就沿锁链继续更新, 用于释放锁和修改优先级之后
+void sched_pi_update(struct task_struct* pthread) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    uint32_t depth = 0;
+    while (pthread != NULL && depth++ < PI_MAX_DEPTH) {
+        uint8_t policy = pthread->normal_policy;
+        uint8_t rt_priority = pthread->normal_rt_priority;
+        int8_t nice = pthread->normal_nice;
+        struct list_elem* lock_elem = pthread->held_locks.head.next;
+        while (lock_elem != &pthread->held_locks.tail) {
+            struct lock* plock = elem2entry(struct lock, holder_tag, lock_elem);
+            struct list* waiters = &plock->semaphore.waiters;
+            struct list_elem* waiter_elem = waiters->head.next;
+            while (waiter_elem != &waiters->tail) {
+                struct task_struct* waiter =
+                    elem2entry(struct task_struct, general_tag, waiter_elem);
+                if (sched_prio(waiter) > prio_key(policy, rt_priority, nice)) {
+                    policy = waiter->policy;
+                    rt_priority = waiter->rt_priority;
+                    nice = waiter->nice;
+                }
+                waiter_elem = waiter_elem->next;
+            }
+            lock_elem = lock_elem->next;
+        }
+        if (policy == pthread->policy && rt_priority == pthread->rt_priority &&
+            nice == pthread->nice) {
+            break;
+        }
+        sched_set_effective(pthread, policy, rt_priority, nice);
+        if (pthread->blocked_on == NULL) { break; }
+        pthread = pthread->blocked_on->holder;
+    }
+}
+
+// 设置pid的nice值, 超出范围的nice会被截断. 成功返回0, 失败返回-1
+int32_t sys_setpriority(pid_t pid, int32_t nice) {
+    if (nice < NICE_MIN) { nice = NICE_MIN; }
+    if (nice > NICE_MAX) { nice = NICE_MAX; }
+    enum intr_status old_status = intr_disable();
+    struct task_struct* pthread = pid2thread(pid);
+    if (pthread == NULL) {
+        intr_set_status(old_status);
+        return -1;
+    }
+    pthread->normal_nice = nice;
+    sched_pi_update(pthread);
+    intr_set_status(old_status);
+    return 0;
+}
+
+// 同linux, 返回20 - nice(范围1~40), 避免与失败时的-1混淆.
+// 返回的是任务自己设置的nice, 不是继承来的
+int32_t sys_getpriority(pid_t pid) {
+    enum intr_status old_status = intr_disable();
+    struct task_struct* pthread = pid2thread(pid);
+    int32_t ret = (pthread == NULL ? -1 : 20 - pthread->normal_nice);
+    intr_set_status(old_status);
+    return ret;
+}
+
+// 修改pid的调度策略和实时优先级, 成功返回0, 失败返回-1
+int32_t sys_sched_setscheduler(pid_t pid, int32_t policy, int32_t rt_priority) {
+    if (policy == SCHED_NORMAL) {
+        if (rt_priority != 0) { return -1; }
+    } else if (policy == SCHED_FIFO || policy == SCHED_RR) {
+        if (rt_priority < 1 || rt_priority >= RT_PRIO_MAX) { return -1; }
+    } else {
+        return -1;
+    }
+
+    enum intr_status old_status = intr_disable();
+    struct task_struct* pthread = pid2thread(pid);
+    if (pthread == NULL) {
+        intr_set_status(old_status);
+        return -1;
+    }
+    pthread->normal_policy = policy;
+    pthread->normal_rt_priority = rt_priority;
+    sched_pi_update(pthread);
+    intr_set_status(old_status);
+    return 0;
+}
+
+// 返回pid的调度策略, 失败返回-1
+int32_t sys_sched_getscheduler(pid_t pid) {
+    enum intr_status old_status = intr_disable();
+    struct task_struct* pthread = pid2thread(pid);
+    int32_t ret = (pthread == NULL ? -1 : pthread->normal_policy);
+    intr_set_status(old_status);
+    return ret;
+}
+
+void sched_init() {
+    ready_cnt = 0;
+    min_vruntime = 0;
+    uint32_t prio;
+    for (prio = 0; prio < RT_PRIO_MAX; prio++) { list_init(&rt_queue[prio]); }
+    rt_bitmap = 0;
+    rt_period_ticks = rt_ticks_used = 0;
+    rt_throttled = false;
+    need_resched = false;
+}
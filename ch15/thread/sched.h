@@ -0,0 +1,61 @@
+#ifndef __THREAD_SCHED_H
+#define __THREAD_SCHED_H
+
+#include "global.h"
+#include "stdint.h"
+#include "thread.h"
+
+// nice值范围, 与linux一致. nice越小权重越大, 分到的cpu越多
+#define NICE_MIN (-20)
+#define NICE_MAX 19
+#define NICE_0_WEIGHT 1024  // nice为0时的权重
+
+// 每个tick给vruntime增加 VRUNTIME_PER_TICK * NICE_0_WEIGHT / weight
+#define VRUNTIME_PER_TICK 1024
+// 唤醒的任务最多比min_vruntime领先这么多, 防止睡久了的任务长期霸占cpu
+#define SCHED_WAKEUP_CREDIT (3 * VRUNTIME_PER_TICK)
+// 当前任务的vruntime超出最左任务这么多时才抢占, 避免来回切换
+#define SCHED_WAKEUP_GRAN VRUNTIME_PER_TICK
+
+#define MAX_READY_TASKS 1024  // 就绪堆的容量
+
+// 调度策略. 实时任务(FIFO/RR)总是先于普通任务运行
+enum sched_policy {
+    SCHED_NORMAL,  // 按vruntime公平调度
+    SCHED_FIFO,    // 实时, 同优先级先来先服务, 不会因时间片用完被换下
+    SCHED_RR       // 实时, 同优先级时间片轮转
+};
+
+#define RT_PRIO_MAX 32       // 实时优先级范围 1 ~ RT_PRIO_MAX-1, 越大越优先
+#define RT_RR_TIMESLICE 10   // SCHED_RR的时间片, 单位tick
+// 实时带宽限制: 每RT_PERIOD个tick里实时任务最多运行RT_RUNTIME个tick,
+// 剩下的留给普通任务, 防止失控的实时任务锁死系统
+#define RT_PERIOD 100
+#define RT_RUNTIME 95
+
+// task_struct中rq_idx的特殊取值
+#define RQ_NONE (-1)  // 不在就绪队列中
+#define RQ_RT (-2)    // 在实时就绪队列中
+
+void sched_init(void);
+uint32_t sched_min_vruntime(void);
+uint32_t nice_to_weight(int8_t nice);
+void sched_enqueue(struct task_struct* pthread);
+void sched_dequeue(struct task_struct* pthread);
+struct task_struct* sched_pick_next(void);
+bool sched_ready_empty(void);
+uint32_t sched_nr_ready(void);
+void sched_put_prev(struct task_struct* cur);
+void sched_yield_place(struct task_struct* cur);
+bool sched_need_resched(void);
+void sched_set_need_resched(void);
+bool sched_tick(struct task_struct* cur);
+int32_t sched_prio(struct task_struct* pthread);
+void sched_pi_boost(struct task_struct* holder, struct task_struct* donor);
+void sched_pi_update(struct task_struct* pthread);
+int32_t sys_setpriority(pid_t pid, int32_t nice);
+int32_t sys_getpriority(pid_t pid);
+int32_t sys_sched_setscheduler(pid_t pid, int32_t policy, int32_t rt_priority);
+int32_t sys_sched_getscheduler(pid_t pid);
+
+#endif
@@ -3,8 +3,33 @@
 #include "global.h"
 #include "debug.h"
 #include "interrupt.h"
+#include "sched.h"
+#include "tsc.h"
 
-void sema_init(struct semaphore* psema, uint8_t value) {
+// 从waiters中摘下优先级最高的任务, 同优先级的先来先出
+static struct task_struct* waiters_pop_highest(struct list* waiters) {
+    struct list_elem* elem = waiters->head.next;
+    struct task_struct* highest =
+        elem2entry(struct task_struct, general_tag, elem);
+    while ((elem = elem->next) != &waiters->tail) {
+        struct task_struct* waiter =
+            elem2entry(struct task_struct, general_tag, elem);
+        if (sched_prio(waiter) > sched_prio(highest)) { highest = waiter; }
+    }
+    list_remove(&highest->general_tag);
+    return highest;
+}
+
+// 唤醒waiters中的所有任务
+static void waiters_wake_all(struct list* waiters) {
+    while (!list_empty(waiters)) {
+        struct task_struct* waiter =
+            elem2entry(struct task_struct, general_tag, list_pop(waiters));
+        thread_unblock(waiter);
+    }
+}
+
+void sema_init(struct semaphore* psema, uint32_t value) {
     psema->value = value;
     list_init(&psema->waiters);
 }
@@ -18,36 +43,46 @@ void lock_init(struct lock* plock) {
 void sema_down(struct semaphore* psema) {
     enum intr_status old_status = intr_disable();
     while (psema->value == 0) {
-        ASSERT(!elem_find(&psema->waiters, &running_thread()->general_tag));
-        if (elem_find(&psema->waiters, &running_thread()->general_tag)) {
-            PANIC("sema_down: thread blocked has been in waiters_list\n");
-        }
-        list_append(&psema->waiters, &running_thread()->general_tag);
+        struct task_struct* cur = running_thread();
+        ASSERT(!elem_linked(&cur->general_tag));
+        ASSERT_SLOW(!elem_find(&psema->waiters, &cur->general_tag));
+        list_append(&psema->waiters, &cur->general_tag);
         thread_block(TASK_BLOCKED);
     }
     psema->value--;
-    ASSERT(psema->value == 0);
     intr_set_status(old_status);
 }
 
 void sema_up(struct semaphore* psema) {
     enum intr_status old_status = intr_disable();
-    ASSERT(psema->value == 0);
     if (!list_empty(&psema->waiters)) {
-        struct task_struct* thread_blocked = elem2entry(struct task_struct, general_tag, list_pop(&psema->waiters));
-        thread_unblock(thread_blocked);
+        thread_unblock(waiters_pop_highest(&psema->waiters));
     }
     psema->value++;
-    ASSERT(psema->value == 1);
     intr_set_status(old_status);
 }
 
 void lock_acquire(struct lock* plock) {
     if (plock->holder != running_thread()) {
-        sema_down(&plock->semaphore);
-        plock->holder = running_thread();
+        struct task_struct* cur = running_thread();
+        struct semaphore* psema = &plock->semaphore;
+        enum intr_status old_status = intr_disable();
+        // 同sema_down, 只是阻塞前让持有者继承自己的优先级
+        while (psema->value == 0) {
+            ASSERT(!elem_linked(&cur->general_tag));
+            ASSERT_SLOW(!elem_find(&psema->waiters, &cur->general_tag));
+            list_append(&psema->waiters, &cur->general_tag);
+            cur->blocked_on = plock;
+            sched_pi_boost(plock->holder, cur);
+            thread_block(TASK_BLOCKED);
+        }
+        cur->blocked_on = NULL;
+        psema->value--;
+        plock->holder = cur;
+        list_append(&cur->held_locks, &plock->holder_tag);
         ASSERT(plock->holder_repeat_nr == 0);
         plock->holder_repeat_nr = 1;
+        intr_set_status(old_status);
     } else { // 本线程再次获取锁
         plock->holder_repeat_nr++;
     }
@@ -60,7 +95,228 @@ void lock_release(struct lock* plock) {
         return;
     }
     ASSERT(plock->holder_repeat_nr == 1);
+    enum intr_status old_status = intr_disable();
+    list_remove(&plock->holder_tag);
     plock->holder = NULL;
     plock->holder_repeat_nr = 0;
+    // 不再替这把锁的等待者运行, 优先级回落
+    sched_pi_update(running_thread());
     sema_up(&plock->semaphore);
+    intr_set_status(old_status);
+}
+
+void rwlock_init(struct rwlock* prwlock) {
+    prwlock->readers = 0;
+    prwlock->writer = NULL;
+    prwlock->writers_waiting = 0;
+    list_init(&prwlock->read_waiters);
+    list_init(&prwlock->write_waiters);
+}
+
+void rwlock_read_acquire(struct rwlock* prwlock) {
+    struct task_struct* cur = running_thread();
+    enum intr_status old_status = intr_disable();
+    ASSERT(prwlock->writer != cur);
+    // 写者优先, 有写者持锁或者在等时都不能进入
+    while (prwlock->writer != NULL || prwlock->writers_waiting > 0) {
+        list_append(&prwlock->read_waiters, &cur->general_tag);
+        thread_block(TASK_BLOCKED);
+    }
+    prwlock->readers++;
+    intr_set_status(old_status);
+}
+
+void rwlock_read_release(struct rwlock* prwlock) {
+    enum intr_status old_status = intr_disable();
+    ASSERT(prwlock->readers > 0 && prwlock->writer == NULL);
+    prwlock->readers--;
+    // 最后一个读者离开, 交给等待的写者
+    if (prwlock->readers == 0 && !list_empty(&prwlock->write_waiters)) {
+        thread_unblock(waiters_pop_highest(&prwlock->write_waiters));
+    }
+    intr_set_status(old_status);
+}
+
+void rwlock_write_acquire(struct rwlock* prwlock) {
+    struct task_struct* cur = running_thread();
+    enum intr_status old_status = intr_disable();
+    ASSERT(prwlock->writer != cur);
+    prwlock->writers_waiting++;
+    while (prwlock->writer != NULL || prwlock->readers > 0) {
+        list_append(&prwlock->write_waiters, &cur->general_tag);
+        thread_block(TASK_BLOCKED);
+    }
+    prwlock->writers_waiting--;
+    prwlock->writer = cur;
+    intr_set_status(old_status);
+}
+
+void rwlock_write_release(struct rwlock* prwlock) {
+    enum intr_status old_status = intr_disable();
+    ASSERT(prwlock->writer == running_thread());
+    prwlock->writer = NULL;
+    // 还有写者在等就交给写者, 否则放行所有读者
+    if (!list_empty(&prwlock->write_waiters)) {
+        thread_unblock(waiters_pop_highest(&prwlock->write_waiters));
+    } else {
+        waiters_wake_all(&prwlock->read_waiters);
+    }
+    intr_set_status(old_status);
+}
+
+void cond_init(struct condition* pcond) {
+    list_init(&pcond->waiters);
+}
+
+// 释放plock并等待, 被唤醒后重新获取plock. 醒来后条件不一定成立, 调用者要循环检查
+void cond_wait(struct condition* pcond, struct lock* plock) {
+    struct task_struct* cur = running_thread();
+    ASSERT(plock->holder == cur && plock->holder_repeat_nr == 1);
+    // 入队和释放锁之间不能插入signal, 否则会丢失唤醒
+    enum intr_status old_status = intr_disable();
+    list_append(&pcond->waiters, &cur->general_tag);
+    lock_release(plock);
+    thread_block(TASK_BLOCKED);
+    intr_set_status(old_status);
+    lock_acquire(plock);
+}
+
+// 唤醒一个等待者, 调用者应持有与条件变量配合的锁
+void cond_signal(struct condition* pcond) {
+    enum intr_status old_status = intr_disable();
+    if (!list_empty(&pcond->waiters)) {
+        thread_unblock(waiters_pop_highest(&pcond->waiters));
+    }
+    intr_set_status(old_status);
+}
+
+// 唤醒所有等待者
+void cond_broadcast(struct condition* pcond) {
+    enum intr_status old_status = intr_disable();
+    waiters_wake_all(&pcond->waiters);
+    intr_set_status(old_status);
+}
+
+// pibench: 低优先级线程持有互斥量时, 高优先级线程来等, 中优先级线程就绪.
+// 有优先级继承时低优先级线程不会被中优先级线程抢占, 高优先级线程只等持锁的时间
+#define PI_BENCH_LOW_PRIO 10
+#define PI_BENCH_MEDIUM_PRIO 20
+#define PI_BENCH_HIGH_PRIO 30
+
+// 三个线程第一次pibench时创建, 之后一直留着. 每跑一遍由start_low开始,
+// 各自做完一遍后up一次done
+static struct pi_bench {
+    bool use_lock;  // 用lock还是用二元信号量做互斥, 信号量没有优先级继承
+    struct lock lock;
+    struct semaphore sema;
+    struct semaphore start_low, start_medium, start_high;
+    struct semaphore done;
+    uint64_t high_wait;  // 高优先级线程的等待时间, 单位纳秒
+} bench;
+
+static bool pi_bench_started;  // 三个线程已创建
+static bool pi_bench_running;  // 同时只能跑一个pibench
+
+static void pi_bench_acquire() {
+    if (bench.use_lock) {
+        lock_acquire(&bench.lock);
+    } else {
+        sema_down(&bench.sema);
+    }
+}
+
+static void pi_bench_release() {
+    if (bench.use_lock) {
+        lock_release(&bench.lock);
+    } else {
+        sema_up(&bench.sema);
+    }
+}
+
+// 开着中断空转us微秒
+static void spin_us(uint32_t us) {
+    uint64_t end = ktime_get() + (uint64_t)us * 1000;
+    while (ktime_get() < end) {}
+}
+
+static void pi_bench_high(void* arg UNUSED) {
+    while (1) {
+        sema_down(&bench.start_high);
+        uint64_t start = ktime_get();
+        pi_bench_acquire();
+        bench.high_wait = ktime_get() - start;
+        pi_bench_release();
+        sema_up(&bench.done);
+    }
+}
+
+static void pi_bench_medium(void* arg UNUSED) {
+    while (1) {
+        sema_down(&bench.start_medium);
+        spin_us(PI_BENCH_MEDIUM_US);
+        sema_up(&bench.done);
+    }
+}
+
+static void pi_bench_low(void* arg UNUSED) {
+    while (1) {
+        sema_down(&bench.start_low);
+        pi_bench_acquire();
+        // 高优先级线程先运行并在锁上阻塞, 然后中优先级线程就绪
+        sema_up(&bench.start_high);
+        thread_yield();
+        sema_up(&bench.start_medium);
+        thread_yield();  // 没有继承到高优先级时, 中优先级线程在这里抢占
+        spin_us(PI_BENCH_HOLD_US);
+        pi_bench_release();
+        sema_up(&bench.done);
+    }
+}
+
+// 创建实时优先级为rt_priority的FIFO线程
+static void pi_bench_start(char* name, thread_func function,
+                           uint8_t rt_priority) {
+    struct task_struct* thread = thread_start(name, 31, function, NULL);
+    sys_sched_setscheduler(thread->pid, SCHED_FIFO, rt_priority);
+}
+
+// 跑一遍, 返回高优先级线程的等待时间, 单位微秒
+static uint32_t pi_bench_run(bool use_lock) {
+    bench.use_lock = use_lock;
+    lock_init(&bench.lock);
+    sema_init(&bench.sema, 1);
+    bench.high_wait = 0;
+    sema_up(&bench.start_low);
+    uint32_t i;
+    for (i = 0; i < 3; i++) { sema_down(&bench.done); }
+    return (uint32_t)div_u64_rem(bench.high_wait, 1000, NULL);
+}
+
+// 分别用lock和二元信号量跑一遍优先级反转的场景, 结果存入res.
+// 成功返回0, 已经有pibench在跑时返回-1
+int32_t sys_pi_bench(struct pi_bench_result* res) {
+    if (res == NULL) { return -1; }
+    enum intr_status old_status = intr_disable();
+    if (pi_bench_running) {
+        intr_set_status(old_status);
+        return -1;
+    }
+    pi_bench_running = true;
+    intr_set_status(old_status);
+    if (!pi_bench_started) {
+        sema_init(&bench.start_low, 0);
+        sema_init(&bench.start_medium, 0);
+        sema_init(&bench.start_high, 0);
+        sema_init(&bench.done, 0);
+        pi_bench_start("pi_low", pi_bench_low, PI_BENCH_LOW_PRIO);
+        pi_bench_start("pi_medium", pi_bench_medium, PI_BENCH_MEDIUM_PRIO);
+        pi_bench_start("pi_high", pi_bench_high, PI_BENCH_HIGH_PRIO);
+        pi_bench_started = true;
+    }
+    res->hold_us = PI_BENCH_HOLD_US;
+    res->medium_us = PI_BENCH_MEDIUM_US;
+    res->lock_wait_us = pi_bench_run(true);
+    res->sema_wait_us = pi_bench_run(false);
+    pi_bench_running = false;
+    return 0;
 }
@@ -5,22 +5,61 @@
 #include "stdint.h"
 #include "thread.h"
 
+// 计数信号量
 struct semaphore {
-    uint8_t value;
+    uint32_t value;
     struct list waiters;
 };
 
+// 锁的等待者就是semaphore.waiters. 持有者会继承等待者中最高的优先级
 struct lock {
     struct task_struct* holder;
     struct semaphore semaphore;
     uint32_t holder_repeat_nr;
+    struct list_elem holder_tag;  // 用于持有者的held_locks队列
 };
 
-void sema_init(struct semaphore* psema, uint8_t value);
+// 读写锁, 写者优先: 有写者在等时, 新来的读者也要等, 避免写者饿死.
+// 同一任务不能重复获取读锁, 否则中间来了写者就会死锁
+struct rwlock {
+    uint32_t readers;                // 持有读锁的任务数
+    struct task_struct* writer;      // 持有写锁的任务
+    uint32_t writers_waiting;        // 等待写锁的任务数
+    struct list read_waiters;
+    struct list write_waiters;
+};
+
+// 条件变量, 总是和一把锁配合使用
+struct condition {
+    struct list waiters;
+};
+
+#define PI_BENCH_HOLD_US 20000    // pibench中低优先级线程持锁的时间
+#define PI_BENCH_MEDIUM_US 50000  // pibench中中优先级线程占用cpu的时间
+
+// pibench的结果, 单位微秒
+struct pi_bench_result {
+    uint32_t hold_us;
+    uint32_t medium_us;
+    uint32_t lock_wait_us;  // 用lock时高优先级线程的等待时间
+    uint32_t sema_wait_us;  // 用二元信号量(没有优先级继承)时的等待时间
+};
+
+void sema_init(struct semaphore* psema, uint32_t value);
 void sema_down(struct semaphore* psema);
 void sema_up(struct semaphore* psema);
 void lock_init(struct lock* plock);
 void lock_acquire(struct lock* plock);
 void lock_release(struct lock* plock);
+void rwlock_init(struct rwlock* prwlock);
+void rwlock_read_acquire(struct rwlock* prwlock);
+void rwlock_read_release(struct rwlock* prwlock);
+void rwlock_write_acquire(struct rwlock* prwlock);
+void rwlock_write_release(struct rwlock* prwlock);
+void cond_init(struct condition* pcond);
+void cond_wait(struct condition* pcond, struct lock* plock);
+void cond_signal(struct condition* pcond);
+void cond_broadcast(struct condition* pcond);
+int32_t sys_pi_bench(struct pi_bench_result* res);
 
 #endif
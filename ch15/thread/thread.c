@@ -1,23 +1,40 @@
 #include "thread.h"
 #include "debug.h"
 #include "file.h"
+#include "fpu.h"
 #include "fs.h"
 #include "global.h"
 #include "interrupt.h"
 #include "memory.h"
 #include "print.h"
 #include "process.h"
+#include "sched.h"
+#include "softirq.h"
 #include "stdint.h"
 #include "stdio.h"
 #include "string.h"
 #include "sync.h"
+#include "tsc.h"
+
+#define PID_HASH_SIZE 128  // 2的幂
+#define PCB_CACHE_SIZE 8   // 最多缓存的pcb页数
 
 struct task_struct* idle_thread;      // idle线程
 struct task_struct* main_thread;      // 主线程PCB
-struct lock pid_lock;                 // pid锁, 用于分配pid
-struct list thread_ready_list;        // 就绪队列
 struct list thread_all_list;          // 所有任务队列
-static struct list_elem* thread_tag;  // 用于保存队列中的线程结点
+
+// pid位图和pid到任务的哈希表, 都在关中断时访问
+static uint8_t pid_bits[(MAX_PID + 1) / 8];
+static struct bitmap pid_bitmap;
+static pid_t last_pid;  // 上一次分配的pid
+static struct list pid_hash[PID_HASH_SIZE];
+static uint64_t switch_stamp;         // 上一次任务切换时的TSC
+static uint32_t nr_switches;          // 任务切换的总次数
+
+// 最近释放的pcb页, 保留着映射, 创建任务时直接复用.
+// 用各自的general_tag串起来, 关中断访问
+static struct list pcb_cache;
+static uint32_t pcb_cache_cnt;
 
 extern void switch_to(struct task_struct* cur, struct task_struct* next);
 
@@ -45,18 +62,89 @@ static void kernel_thread(thread_func* function, void* func_arg) {
     function(func_arg);
 }
 
-static pid_t allocate_pid() {
-    static pid_t next_pid = 0;
-    lock_acquire(&pid_lock);
-    next_pid++;
-    lock_release(&pid_lock);
-    return next_pid;
+static struct list* pid_bucket(pid_t pid) {
+    return &pid_hash[pid & (PID_HASH_SIZE - 1)];
+}
+
+// 从上一次分配的pid往后找空闲的pid(next-fit), 到MAX_PID后从1开始.
+// 刚释放的pid要等一轮之后才会被重用. 分配到的pid和任务一起加入哈希表
+static pid_t allocate_pid(struct task_struct* pthread) {
+    enum intr_status old_status = intr_disable();
+    pid_t pid = last_pid;
+    uint32_t tries = 0;
+    while (tries < MAX_PID) {
+        pid = pid >= MAX_PID ? 1 : pid + 1;
+        tries++;
+        if (pid_bits[pid / 8] == 0xff) {  // 整个字节都被占用, 直接跳到下一字节
+            uint32_t skip = 7 - pid % 8;
+            pid += skip;
+            tries += skip;
+            continue;
+        }
+        if (!bitmap_scan_test(&pid_bitmap, pid)) { break; }
+    }
+    if (bitmap_scan_test(&pid_bitmap, pid)) {
+        PANIC("allocate_pid: no free pid\n");
+    }
+    bitmap_set(&pid_bitmap, pid, 1);
+    last_pid = pid;
+    list_append(pid_bucket(pid), &pthread->pid_tag);
+    intr_set_status(old_status);
+    return pid;
 }
 
 /* fork进程时为其分配pid,因为allocate_pid已经是静态的,别的文件无法调用.
 不想改变函数定义了,故定义fork_pid函数来封装一下。*/
-pid_t fork_pid() {
-    return allocate_pid();
+pid_t fork_pid(struct task_struct* pthread) {
+    return allocate_pid(pthread);
+}
+
+// 任务的pcb释放前调用, 归还pid并从哈希表中删除
+void release_pid(pid_t pid) {
+    enum intr_status old_status = intr_disable();
+    ASSERT(bitmap_scan_test(&pid_bitmap, pid));
+    struct task_struct* pthread = pid2thread(pid);
+    ASSERT(pthread != NULL && pthread->pid == pid);
+    list_remove(&pthread->pid_tag);
+    bitmap_set(&pid_bitmap, pid, 0);
+    intr_set_status(old_status);
+}
+
+static void pid_init() {
+    pid_bitmap.bits = pid_bits;
+    pid_bitmap.btmp_bytes_len = sizeof(pid_bits);
+    bitmap_init(&pid_bitmap);
+    bitmap_set(&pid_bitmap, 0, 1);  // 0表示当前任务, 不分配
+    last_pid = 0;
+    uint32_t i;
+    for (i = 0; i < PID_HASH_SIZE; i++) { list_init(&pid_hash[i]); }
+}
+
+// 分配一页给pcb和内核栈, 失败返回NULL. 优先从缓存中取, 省去分配虚拟地址和物理页,
+// 改页表和清零. 缓存的页内容是旧的, task_struct由init_thread或fork重新初始化
+struct task_struct* pcb_alloc() {
+    enum intr_status old_status = intr_disable();
+    if (!list_empty(&pcb_cache)) {
+        struct list_elem* elem = list_pop(&pcb_cache);
+        pcb_cache_cnt--;
+        intr_set_status(old_status);
+        return elem2entry(struct task_struct, general_tag, elem);
+    }
+    intr_set_status(old_status);
+    return get_kernel_pages(1);
+}
+
+// 释放任务的pcb页. 缓存没满时留着下次用, 后放入的先取出, 它更可能还在cache中
+void pcb_free(struct task_struct* pthread) {
+    enum intr_status old_status = intr_disable();
+    if (pcb_cache_cnt < PCB_CACHE_SIZE) {
+        list_push(&pcb_cache, &pthread->general_tag);
+        pcb_cache_cnt++;
+        intr_set_status(old_status);
+        return;
+    }
+    intr_set_status(old_status);
+    mfree_page(PF_KERNEL, pthread, 1);
 }
 
 // 初始化线程栈thread_stack
@@ -79,7 +167,6 @@ void thread_create(struct task_struct* pthread,
 // 初始化线程基本信息
 void init_thread(struct task_struct* pthread, char* name, int prio) {
     memset(pthread, 0, sizeof(*pthread));
-    pthread->pid = allocate_pid();
     strcpy(pthread->name, name);
 
     if (pthread == main_thread) {
@@ -91,7 +178,20 @@ void init_thread(struct task_struct* pthread, char* name, int prio) {
     pthread->self_kstack = (uint32_t*)((uint32_t)pthread + PG_SIZE);
     pthread->priority = prio;
     pthread->ticks = prio;
-    pthread->elapsed_ticks = 0;
+    pthread->cpu_cycles = 0;
+    pthread->state_stamp = rdtsc();  // 新任务从就绪开始
+    pthread->nice = 0;
+    pthread->weight = nice_to_weight(0);
+    pthread->vruntime = sched_min_vruntime();
+    pthread->rq_idx = RQ_NONE;
+    pthread->policy = SCHED_NORMAL;
+    pthread->rt_priority = 0;
+    pthread->normal_nice = 0;
+    pthread->normal_policy = SCHED_NORMAL;
+    pthread->normal_rt_priority = 0;
+    pthread->blocked_on = NULL;
+    list_init(&pthread->held_locks);
+    pthread->pid = allocate_pid(pthread);
     pthread->fd_table[0] = 0;
     pthread->fd_table[1] = 1;
     pthread->fd_table[2] = 2;
@@ -104,6 +204,15 @@ void init_thread(struct task_struct* pthread, char* name, int prio) {
 
     // 根目录作为默认工作路径
     pthread->cwd_inode_nr = 0;
+    pthread->group_leader = pthread;
+    pthread->nr_threads = 1;
+    pthread->tls = NULL;
+    pthread->joiner = NULL;
+    pthread->exit_status = 0;
+    pthread->io_ring = NULL;
+    pthread->exit_task = NULL;
+    list_init(&pthread->child_waiters);
+    pthread->fpu = NULL;
     pthread->stack_magic = 0x19870916;
 }
 
@@ -111,14 +220,13 @@ void init_thread(struct task_struct* pthread, char* name, int prio) {
 struct task_struct*
 thread_start(char* name, int prio, thread_func function, void* func_arg) {
     // pcb位于内核
-    struct task_struct* thread = get_kernel_pages(1);
+    struct task_struct* thread = pcb_alloc();
     init_thread(thread, name, prio);
     thread_create(thread, function, func_arg);
 
-    ASSERT(!elem_find(&thread_ready_list, &thread->general_tag));
-    list_append(&thread_ready_list, &thread->general_tag);  // 加入就绪队列
+    sched_enqueue(thread);  // 加入就绪队列
 
-    ASSERT(!elem_find(&thread_all_list, &thread->all_list_tag));
+    ASSERT(!elem_linked(&thread->all_list_tag));
     list_append(&thread_all_list, &thread->all_list_tag);  // 加入全部线程队列
 
     return thread;
@@ -127,8 +235,10 @@ thread_start(char* name, int prio, thread_func function, void* func_arg) {
 static void make_main_thread() {
     main_thread = running_thread();
     init_thread(main_thread, "main", 31);
+    // main从这里开始计时, 之前开机和加载内核的时间不算它的
+    switch_stamp = rdtsc();
 
-    ASSERT(!elem_find(&thread_all_list, &main_thread->all_list_tag));
+    ASSERT(!elem_linked(&main_thread->all_list_tag));
     list_append(&thread_all_list,
                 &main_thread->all_list_tag);  // 加入到thread all list
 }
@@ -137,26 +247,35 @@ void schedule() {
     ASSERT(intr_get_status() == INTR_OFF);
 
     struct task_struct* cur = running_thread();
-    if (cur->status == TASK_RUNNING) {  // cpu时间到了, 加到就绪队列
-        ASSERT(!elem_find(&thread_ready_list, &cur->general_tag))
-        list_append(&thread_ready_list, &cur->general_tag);
-        cur->ticks = cur->priority;
+    uint64_t now = rdtsc();
+    cur->cpu_cycles += now - switch_stamp;
+    switch_stamp = now;
+
+    bool preempted = (cur->status == TASK_RUNNING);
+    if (cur->status == TASK_RUNNING) {  // cpu时间到了或被抢占, 加到就绪队列
+        sched_put_prev(cur);
         cur->status = TASK_READY;
     } else {  // 其他情况, 比如等待磁盘io, 就不能加到就绪队列
     }
 
-    if (list_empty(&thread_ready_list)) { thread_unblock(idle_thread); }
-    thread_tag = NULL;
-    thread_tag = list_pop(&thread_ready_list);
-    // elem2entry把tag转化成task_struct
-    // 第三个参数是thread_tag, 就是要转化的tag, 第一个参数是要转化成什么类
-    // 第二个参数是thread_tag在这个类里面叫什么
-    struct task_struct* next =
-        elem2entry(struct task_struct, general_tag, thread_tag);
+    if (sched_ready_empty()) { thread_unblock(idle_thread); }
+    // 实时任务优先, 否则选出vruntime最小的任务
+    struct task_struct* next = sched_pick_next();
     next->status = TASK_RUNNING;
+    if (next != cur) {
+        nr_switches++;
+        if (preempted) {
+            cur->nivcsw++;
+        } else {
+            cur->nvcsw++;
+        }
+        cur->state_stamp = now;  // 开始就绪等待或阻塞
+        next->wait_cycles += now - next->state_stamp;
+    }
 
     // 激活页目录表和页表
     process_activate(next);
+    fpu_switch(next);
     switch_to(cur, next);
 }
 
@@ -164,8 +283,8 @@ void schedule() {
 void thread_yield() {
     struct task_struct* cur = running_thread();
     enum intr_status old_status = intr_disable();
-    ASSERT(!elem_find(&thread_ready_list, &cur->general_tag));
-    list_append(&thread_ready_list, &cur->general_tag);
+    sched_yield_place(cur);
+    sched_enqueue(cur);
     cur->status = TASK_READY;
     schedule();
     intr_set_status(old_status);
@@ -188,12 +307,21 @@ void thread_unblock(struct task_struct* pthread) {
             (pthread->status == TASK_WAITING) ||
             (pthread->status == TASK_HANGING)));
     if (pthread->status != TASK_READY) {
-        ASSERT(!elem_find(&thread_ready_list, &pthread->general_tag));
-        if (elem_find(&thread_ready_list, &pthread->general_tag)) {
+        if (pthread->rq_idx != RQ_NONE) {
             PANIC("thread_unblock: blocked thread in ready_list\n");
         }
-        list_push(&thread_ready_list, &pthread->general_tag);
+        // 被唤醒的任务按vruntime入堆, 睡眠期间落下的vruntime会得到有限的补偿
+        sched_enqueue(pthread);
         pthread->status = TASK_READY;
+        uint64_t now = rdtsc();
+        pthread->block_cycles += now - pthread->state_stamp;
+        pthread->state_stamp = now;
+        // 不在中断上下文中(调用前开着中断), 立刻让更高优先级的实时任务运行.
+        // 中断中唤醒的则由下一个时钟中断处理, 延迟不超过一个tick. 软中断开着中断,
+        // 但在这里切换会推迟其他软中断, 留到irq_exit的末尾
+        if (old_status == INTR_ON && !in_softirq() && sched_need_resched()) {
+            schedule();
+        }
     }
     intr_set_status(old_status);
 }
@@ -236,7 +364,9 @@ static bool elem2thread_info(struct list_elem* pelem, int arg UNUSED) {
         case 4: pad_print(out_pad, 16, "HANGING", 's'); break;
         case 5: pad_print(out_pad, 16, "DIED", 's');
     }
-    pad_print(out_pad, 16, &pthread->elapsed_ticks, 'x');
+    uint32_t cpu_ms = (uint32_t)div_u64_rem(
+        cycles_to_ns(thread_cpu_cycles(pthread)), 1000000, NULL);
+    pad_print(out_pad, 16, &cpu_ms, 'd');
 
     memset(out_pad, 0, 16);
     ASSERT(strlen(pthread->name) < 17);
@@ -247,19 +377,119 @@ static bool elem2thread_info(struct list_elem* pelem, int arg UNUSED) {
     // 此处返回false是为了迎合主调函数list_traversal,只有回调函数返回false时才会继续调用此函数
 }
 
+// pid为0表示当前任务, 找不到返回NULL
+struct task_struct* pid2thread(pid_t pid) {
+    if (pid == 0) { return running_thread(); }
+    if (pid < 0) { return NULL; }
+    enum intr_status old_status = intr_disable();
+    struct list* bucket = pid_bucket(pid);
+    struct list_elem* elem = bucket->head.next;
+    struct task_struct* found = NULL;
+    while (elem != &bucket->tail) {
+        struct task_struct* pthread =
+            elem2entry(struct task_struct, pid_tag, elem);
+        if (pthread->pid == pid) {
+            found = pthread;
+            break;
+        }
+        elem = elem->next;
+    }
+    intr_set_status(old_status);
+    return found;
+}
+
+// 任务占用的cpu周期数, 包括正在运行的任务本次上cpu以来的部分
+uint64_t thread_cpu_cycles(struct task_struct* pthread) {
+    enum intr_status old_status = intr_disable();
+    uint64_t cycles = pthread->cpu_cycles;
+    if (pthread == running_thread()) { cycles += rdtsc() - switch_stamp; }
+    intr_set_status(old_status);
+    return cycles;
+}
+
+// 进程中存活和未回收的线程占用的cpu周期数之和, 已被thread_join回收的不算
+uint64_t thread_group_cpu_cycles(struct task_struct* leader) {
+    enum intr_status old_status = intr_disable();
+    uint64_t cycles = 0;
+    struct list_elem* elem = thread_all_list.head.next;
+    while (elem != &thread_all_list.tail) {
+        struct task_struct* pthread =
+            elem2entry(struct task_struct, all_list_tag, elem);
+        if (pthread->group_leader == leader) {
+            cycles += thread_cpu_cycles(pthread);
+        }
+        elem = elem->next;
+    }
+    intr_set_status(old_status);
+    return cycles;
+}
+
+static uint32_t cycles_to_ms(uint64_t cycles) {
+    return (uint32_t)div_u64_rem(cycles_to_ns(cycles), 1000000, NULL);
+}
+
+// 把任务的统计填入st, 正在就绪等待或阻塞的任务加上这次已经过去的时间
+static void fill_task_stat(struct task_struct* pthread, struct task_stat* st,
+                           uint64_t now) {
+    uint64_t wait = pthread->wait_cycles, block = pthread->block_cycles;
+    if (pthread->status == TASK_READY) {
+        wait += now - pthread->state_stamp;
+    } else if (pthread->status == TASK_BLOCKED ||
+               pthread->status == TASK_WAITING) {
+        block += now - pthread->state_stamp;
+    }
+    st->pid = pthread->pid;
+    st->tgid = pthread->group_leader->pid;
+    st->status = pthread->status;
+    memcpy(st->name, pthread->name, TASK_NAME_LEN);
+    st->run_ms = cycles_to_ms(thread_cpu_cycles(pthread));
+    st->wait_ms = cycles_to_ms(wait);
+    st->block_ms = cycles_to_ms(block);
+    st->nvcsw = pthread->nvcsw;
+    st->nivcsw = pthread->nivcsw;
+}
+
+// 取系统的调度统计, 以及最多max_tasks个任务的统计存入tasks.
+// 返回填入的任务数, sys为NULL时返回-1
+int32_t sys_getstats(struct sys_stat* sys, struct task_stat* tasks,
+                     uint32_t max_tasks) {
+    if (sys == NULL) { return -1; }
+    enum intr_status old_status = intr_disable();
+    uint64_t now = rdtsc();
+    sys->uptime_ms = (uint32_t)div_u64_rem(ktime_get(), 1000000, NULL);
+    sys->idle_ms = cycles_to_ms(thread_cpu_cycles(idle_thread));
+    sys->nr_switches = nr_switches;
+    sys->nr_running = sched_nr_ready();
+    sys->nr_tasks = 0;
+    uint32_t cnt = 0;
+    struct list_elem* elem = thread_all_list.head.next;
+    while (elem != &thread_all_list.tail) {
+        struct task_struct* pthread =
+            elem2entry(struct task_struct, all_list_tag, elem);
+        if (tasks != NULL && cnt < max_tasks) {
+            fill_task_stat(pthread, &tasks[cnt++], now);
+        }
+        sys->nr_tasks++;
+        elem = elem->next;
+    }
+    intr_set_status(old_status);
+    return cnt;
+}
+
 /* 打印任务列表 */
 void sys_ps() {
     char* ps_title =
-        "PID            PPID           STAT           TICKS          COMMAND\n";
+        "PID            PPID           STAT           CPU(ms)        COMMAND\n";
     sys_write(stdout_no, ps_title, strlen(ps_title));
     list_traversal(&thread_all_list, elem2thread_info, 0);
 }
 
 void thread_init() {
     put_str("thread_init start\n");
-    list_init(&thread_ready_list);
+    sched_init();
     list_init(&thread_all_list);
-    lock_init(&pid_lock);
+    list_init(&pcb_cache);
+    pid_init();
     process_execute(init, "init");
     make_main_thread();  // 将main函数创建为线程
     idle_thread = thread_start("idle", 10, idle, NULL);
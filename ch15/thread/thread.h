@@ -8,6 +8,7 @@
 
 #define TASK_NAME_LEN 16
 #define MAX_FILES_OPEN_PER_PROC 8
+#define MAX_PID 32767  // pid_t是16位有符号数
 
 // 线程运行的函数, 参数定义为void*后面再转换为对应数据. 跟posix那个差不多
 typedef void thread_func(void*);
@@ -65,6 +66,10 @@ struct thread_stack {
   void* func_arg;
 };
 
+struct lock;
+struct fpu_state;
+struct io_ring_ctx;
+
 // 进程or线程的pcb
 struct task_struct {
   uint32_t* self_kstack;  // 内核栈
@@ -76,8 +81,31 @@ struct task_struct {
       // 每次时间中断都会减一, 到0的时候就被换下cpu
       // prio越大, tick越大, 可以执行越久
 
-  // 任务执行了多久(占用cpu时间). 从开始到结束(换上换下cpu都不会清0)
-  uint32_t elapsed_ticks;
+  // 任务执行了多久(占用cpu时间), 单位是TSC周期. 在schedule中换下cpu时累加
+  uint64_t cpu_cycles;
+  // 调度统计, 单位同上. state_stamp是进入就绪或阻塞状态时的TSC
+  uint64_t wait_cycles;   // 就绪但没在运行的时间
+  uint64_t block_cycles;  // 阻塞的时间
+  uint64_t state_stamp;
+  uint32_t nvcsw;         // 主动让出cpu(阻塞或yield)的次数
+  uint32_t nivcsw;        // 被抢占的次数
+
+  // 公平调度用. 每个tick按weight折算后累加到vruntime, 总是调度vruntime最小的任务
+  int8_t nice;        // -20 ~ 19, 越小权重越大
+  uint32_t weight;    // 由nice换算出的权重
+  uint32_t vruntime;  // 虚拟运行时间
+  int32_t rq_idx;     // 在就绪堆中的下标, 取值见sched.h中的RQ_NONE/RQ_RT
+
+  uint8_t policy;       // 调度策略, 见enum sched_policy
+  uint8_t rt_priority;  // 实时优先级, 普通任务为0
+
+  // 优先级继承. 上面的nice/policy/rt_priority是生效的值, 可能继承自等锁的任务,
+  // 下面是任务自己设置的值, 释放锁后回落到这里
+  int8_t normal_nice;
+  uint8_t normal_policy;
+  uint8_t normal_rt_priority;
+  struct lock* blocked_on;  // 正在等待的锁
+  struct list held_locks;   // 持有的锁
 
   // 线程自己的文件描述符表
   // 举例: fd_table[5] = 6, 说明该线程下标为5的文件在全局文件描述符表中下标为6
@@ -87,6 +115,8 @@ struct task_struct {
 
   struct list_elem all_list_tag;  // 用于thread_all_list中的结点
 
+  struct list_elem pid_tag;  // 用于pid哈希表中的结点
+
   uint32_t* pgdir;  // 进程自己页表的虚拟地址
 
   struct virtual_addr userprog_vaddr;  // 用户进程的虚拟地址
@@ -97,10 +127,43 @@ struct task_struct {
 
   int16_t parent_pid;  // 父进程pid
 
+  // 线程组. 同一进程的线程共享主线程的pgdir, fd_table, userprog_vaddr,
+  // u_block_desc和cwd_inode_nr, 访问这些资源要通过group_leader
+  struct task_struct* group_leader;  // 主线程, 进程的主线程指向自己
+  uint32_t nr_threads;               // 仅主线程有效, 组内存活的线程数
+  void* tls;                         // 线程私有数据, 用户态gs段的基址
+  struct task_struct* joiner;        // 在thread_join中等待本线程退出的任务
+  int32_t exit_status;               // 退出码
+  struct io_ring_ctx* io_ring;       // 仅主线程有效, 进程的异步系统调用环
+  struct task_struct* exit_task;     // 仅主线程有效, 正在执行exit的线程, 非NULL表示进程在退出
+  struct list child_waiters;         // 仅主线程有效, 在wait中等待子进程退出的线程
+
+  struct fpu_state* fpu;  // x87/SSE状态保存区, 没用过fpu的任务为NULL
+
   uint32_t stack_magic;  // 边界标记, 用于检测栈的溢出
 };
 
-extern struct list thread_ready_list;
+// sys_getstats返回的统计, 时间单位都是毫秒
+struct task_stat {
+  pid_t pid;
+  pid_t tgid;  // 所属进程, 即主线程的pid
+  uint8_t status;
+  char name[TASK_NAME_LEN];
+  uint32_t run_ms;    // 运行时间
+  uint32_t wait_ms;   // 就绪等待时间
+  uint32_t block_ms;  // 阻塞时间
+  uint32_t nvcsw;
+  uint32_t nivcsw;
+};
+
+struct sys_stat {
+  uint32_t uptime_ms;    // 开机以来的时间
+  uint32_t idle_ms;      // idle线程运行的时间
+  uint32_t nr_switches;  // 任务切换的总次数
+  uint32_t nr_running;   // 就绪队列长度, 不含正在运行的任务
+  uint32_t nr_tasks;     // 任务总数
+};
+
 extern struct list thread_all_list;
 
 void thread_create(struct task_struct* pthread, thread_func function,
@@ -108,9 +171,18 @@ void thread_create(struct task_struct* pthread, thread_func function,
 void init_thread(struct task_struct* pthread, char* name, int prio);
 struct task_struct* thread_start(char* name, int prio, thread_func function,
                                  void* func_arg);
-pid_t fork_pid();
+struct task_struct* pcb_alloc(void);
+void pcb_free(struct task_struct* pthread);
+pid_t fork_pid(struct task_struct* pthread);
+void release_pid(pid_t pid);
 struct task_struct* running_thread();
 void schedule();
+void thread_yield(void);
+uint64_t thread_cpu_cycles(struct task_struct* pthread);
+uint64_t thread_group_cpu_cycles(struct task_struct* leader);
+int32_t sys_getstats(struct sys_stat* sys, struct task_stat* tasks,
+                     uint32_t max_tasks);
+struct task_struct* pid2thread(pid_t pid);
 void thread_block(enum task_status stat);
 void thread_unblock(struct task_struct* pthread);
 void sys_ps();
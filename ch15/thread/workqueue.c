@@ -0,0 +1,57 @@
+#include "workqueue.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "print.h"
+#include "stdio.h"
+#include "sync.h"
+#include "thread.h"
+
+// 系统工作队列. 所有工作线程从同一个链表取工作, 关中断访问
+static struct list work_list;
+static struct semaphore work_cnt;  // 队列中的工作数
+
+void work_init(struct work_struct* work, work_func func, void* arg) {
+    work->entry.prev = work->entry.next = NULL;
+    work->func = func;
+    work->arg = arg;
+    work->pending = false;
+}
+
+// 把work加入系统工作队列, 它已经在队列中时返回false
+bool queue_work(struct work_struct* work) {
+    enum intr_status old_status = intr_disable();
+    if (work->pending) {
+        intr_set_status(old_status);
+        return false;
+    }
+    work->pending = true;
+    list_append(&work_list, &work->entry);
+    sema_up(&work_cnt);  // 关着中断, 只唤醒工作线程, 不会在这里切换
+    intr_set_status(old_status);
+    return true;
+}
+
+static void worker_thread(void* arg UNUSED) {
+    while (true) {
+        sema_down(&work_cnt);
+        enum intr_status old_status = intr_disable();
+        struct work_struct* work =
+            elem2entry(struct work_struct, entry, list_pop(&work_list));
+        work->pending = false;
+        intr_set_status(old_status);
+        work->func(work->arg);
+    }
+}
+
+void workqueue_init() {
+    put_str("workqueue_init start\n");
+    list_init(&work_list);
+    sema_init(&work_cnt, 0);
+    uint32_t i;
+    for (i = 0; i < WQ_NR_WORKERS; i++) {
+        char name[TASK_NAME_LEN];
+        sprintf(name, "kworker%d", i);
+        thread_start(name, 31, worker_thread, NULL);
+    }
+    put_str("workqueue_init done\n");
+}
@@ -0,0 +1,25 @@
+#ifndef __THREAD_WORKQUEUE_H
+#define __THREAD_WORKQUEUE_H
+
+#include "global.h"
+#include "list.h"
+#include "stdint.h"
+
+#define WQ_NR_WORKERS 2  // 工作线程个数
+
+typedef void work_func(void* arg);
+
+// 推迟到内核线程中执行的工作. 可以在中断和软中断中提交, 回调在线程上下文中执行, 可以睡眠.
+// 提交后到开始执行前不能再次提交, 执行时可以
+struct work_struct {
+    struct list_elem entry;
+    work_func* func;
+    void* arg;
+    bool pending;  // 在队列中还没开始执行
+};
+
+void work_init(struct work_struct* work, work_func func, void* arg);
+bool queue_work(struct work_struct* work);
+void workqueue_init(void);
+
+#endif
@@ -0,0 +1,129 @@
+#include "clone.h"
+#include "debug.h"
+#include "fpu.h"
+#include "global.h"
+#include "interrupt.h"
+#include "list.h"
+#include "memory.h"
+#include "process.h"
+#include "sched.h"
+#include "string.h"
+#include "thread.h"
+
+extern void intr_exit();
+
+// 构建新线程的intr_stack和thread_stack, 第一次被调度时经intr_exit进入用户态
+static void build_thread_stack(struct task_struct* thread,
+                               const struct clone_args* args) {
+    struct intr_stack* intr_0_stack =
+        (struct intr_stack*)((uint32_t)thread + PG_SIZE -
+                             sizeof(struct intr_stack));
+    memset(intr_0_stack, 0, sizeof(struct intr_stack));
+    intr_0_stack->gs = SELECTOR_U_TLS;
+    intr_0_stack->ds = intr_0_stack->es = intr_0_stack->fs = SELECTOR_U_DATA;
+    intr_0_stack->eip = (void*)args->func;
+    intr_0_stack->cs = SELECTOR_U_CODE;
+    intr_0_stack->eflags = (EFLAGS_IOPL_0 | EFLAGS_MBS | EFLAGS_IF_1);
+    intr_0_stack->ss = SELECTOR_U_STACK;
+
+    // 按cdecl在用户栈上放好参数和一个空的返回地址
+    uint32_t* ustack = (uint32_t*)args->stack_top;
+    *--ustack = (uint32_t)args->arg;
+    *--ustack = 0;
+    intr_0_stack->esp = ustack;
+
+    // 同fork, switch_to返回到intr_exit
+    uint32_t* ret_addr_in_thread_stack = (uint32_t*)intr_0_stack - 1;
+    *ret_addr_in_thread_stack = (uint32_t)intr_exit;
+    uint32_t* ebp_ptr_in_thread_stack = (uint32_t*)intr_0_stack - 5;
+    memset(ebp_ptr_in_thread_stack, 0, 4 * sizeof(uint32_t));
+    thread->self_kstack = ebp_ptr_in_thread_stack;
+}
+
+// 在当前进程中创建线程, 与其他线程共享pgdir, 文件描述符和用户堆.
+// 成功返回新线程的tid(即它的pid), 失败返回-1
+pid_t sys_clone(const struct clone_args* args) {
+    struct task_struct* cur = running_thread();
+    if (cur->pgdir == NULL || args == NULL || args->func == NULL) { return -1; }
+    uint32_t stack_top = (uint32_t)args->stack_top;
+    if (stack_top < USER_VADDR_START + 8 || stack_top > 0xc0000000) {
+        return -1;
+    }
+
+    struct task_struct* thread = pcb_alloc();
+    if (thread == NULL) { return -1; }
+    init_thread(thread, cur->name, cur->priority);
+
+    struct task_struct* leader = cur->group_leader;
+    thread->pgdir = leader->pgdir;
+    thread->group_leader = leader;
+    thread->parent_pid = leader->parent_pid;
+    thread->tls = args->tls;
+    // 调度参数继承自调用者, 继承来的优先级不算
+    thread->normal_nice = thread->nice = cur->normal_nice;
+    thread->weight = nice_to_weight(thread->nice);
+    thread->normal_policy = thread->policy = cur->normal_policy;
+    thread->normal_rt_priority = thread->rt_priority = cur->normal_rt_priority;
+    build_thread_stack(thread, args);
+
+    enum intr_status old_status = intr_disable();
+    leader->nr_threads++;
+    ASSERT(!elem_linked(&thread->all_list_tag));
+    list_append(&thread_all_list, &thread->all_list_tag);
+    sched_enqueue(thread);
+    intr_set_status(old_status);
+    return thread->pid;
+}
+
+// 结束当前线程, 不会返回. 线程只释放自己的pcb, 共享的资源归主线程, 由进程退出时释放.
+// pcb由thread_join回收, 进程退出后由wait回收, 在那之前线程处于HANGING状态.
+// 进程退出时主线程也经这里结束, 它的退出码是进程的, 不覆盖
+void thread_die(int32_t status) {
+    struct task_struct* cur = running_thread();
+    struct task_struct* leader = cur->group_leader;
+    intr_disable();
+    if (cur != leader) { cur->exit_status = status; }
+    fpu_release(cur);
+    ASSERT(leader->nr_threads > 1);
+    leader->nr_threads--;
+    if (cur->joiner != NULL) { thread_unblock(cur->joiner); }
+    // 执行exit的线程在等其他线程都结束. 它也可能正睡在锁上, 那时不能唤醒
+    struct task_struct* exit_task = leader->exit_task;
+    if (exit_task != NULL && leader->nr_threads == 1 &&
+        exit_task->status == TASK_WAITING) {
+        thread_unblock(exit_task);
+    }
+    thread_block(TASK_HANGING);
+    PANIC("thread_die: a hanging thread was scheduled");
+}
+
+// 结束当前线程. 主线程不能调用, 返回-1
+int32_t sys_thread_exit(int32_t status) {
+    struct task_struct* cur = running_thread();
+    if (cur == cur->group_leader) { return -1; }
+    thread_die(status);
+    return -1;
+}
+
+// 等待同一进程中的线程tid结束并回收它的pcb, 退出码存入status.
+// 每个线程只能被join一次, 成功返回0, 失败返回-1
+int32_t sys_thread_join(pid_t tid, int32_t* status) {
+    struct task_struct* cur = running_thread();
+    enum intr_status old_status = intr_disable();
+    struct task_struct* thread = pid2thread(tid);
+    if (thread == NULL || thread == cur ||
+        thread->group_leader != cur->group_leader ||
+        thread == thread->group_leader || thread->joiner != NULL) {
+        intr_set_status(old_status);
+        return -1;
+    }
+    thread->joiner = cur;
+    while (thread->status != TASK_HANGING) { thread_block(TASK_WAITING); }
+    if (status != NULL) { *status = thread->exit_status; }
+    list_remove(&thread->all_list_tag);
+    intr_set_status(old_status);
+    fpu_release(thread);
+    release_pid(thread->pid);
+    pcb_free(thread);
+    return 0;
+}
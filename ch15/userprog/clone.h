@@ -0,0 +1,19 @@
+#ifndef __USERPROG_CLONE_H
+#define __USERPROG_CLONE_H
+
+#include "thread.h"
+
+// clone的参数. 用户栈和tls由调用者分配, 与进程中其他线程共享地址空间
+struct clone_args {
+    void (*func)(void* arg);  // 新线程在用户态执行的函数, 不能返回, 结束时调用thread_exit
+    void* arg;
+    void* stack_top;          // 新线程的用户栈栈顶
+    void* tls;                // 线程私有数据, 新线程的gs段以它为基址
+};
+
+pid_t sys_clone(const struct clone_args* args);
+void thread_die(int32_t status);
+int32_t sys_thread_exit(int32_t status);
+int32_t sys_thread_join(pid_t tid, int32_t* status);
+
+#endif
@@ -1,4 +1,5 @@
 #include "exec.h"
+#include "fpu.h"
 #include "fs.h"
 #include "global.h"
 #include "memory.h"
@@ -165,6 +166,7 @@ int32_t sys_execv(const char* path, const char* argv[]) {
   // 修改进程名
   memcpy(cur->name, path, TASK_NAME_LEN);
   cur->name[TASK_NAME_LEN - 1] = 0;
+  fpu_release(cur);  // 新程序从干净的fpu状态开始
 
   struct intr_stack* intr_0_stack =
       (struct intr_stack*)((uint32_t)cur + PG_SIZE - sizeof(struct intr_stack));
@@ -1,37 +1,70 @@
 #include "fork.h"
 #include "debug.h"
 #include "file.h"
+#include "fpu.h"
 #include "interrupt.h"
 #include "memory.h"
 #include "process.h"
+#include "sched.h"
 #include "string.h"
+#include "tsc.h"
+#include "vdso.h"
 #include "thread.h"
 
 extern void intr_exit();
 
+// 子进程虚拟地址池位图占的页数
+#define VADDR_BITMAP_PG_CNT \
+    DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8, PG_SIZE)
+
 // 将父进程的pcb, 虚拟地址位图, stack copy到子进程
 static int32_t copy_pcb_vaddrbitmap_stack0(struct task_struct* child_thread,
                                            struct task_struct* parent_thread) {
     // 复制pcb所在的整个页,里面包含进程pcb信息及特级0极的栈, 返回地址
-    // 复制完还要修改个别项, 比如elapsed_ticks...
+    // 复制完还要修改个别项, 比如cpu_cycles...
+    // pid等所有可能失败的分配都成功后再分配, 见copy_process
     memcpy(child_thread, parent_thread, PG_SIZE);
-    child_thread->pid = fork_pid();
-    child_thread->elapsed_ticks = 0;
+    child_thread->cpu_cycles = 0;
+    child_thread->wait_cycles = child_thread->block_cycles = 0;
+    child_thread->nvcsw = child_thread->nivcsw = 0;
+    child_thread->state_stamp = rdtsc();
     child_thread->status = TASK_READY;
     child_thread->ticks = child_thread->priority;  // 为新进程把时间片充满
-    child_thread->parent_pid = parent_thread->pid;
+    child_thread->parent_pid = parent_thread->group_leader->pid;
     child_thread->general_tag.prev = child_thread->general_tag.next = NULL;
+    child_thread->rq_idx = RQ_NONE;  // 调度策略, nice和vruntime继承父进程
+    child_thread->blocked_on = NULL;
+    list_init(&child_thread->held_locks);  // 锁不会被继承
+    // 子进程没有持锁, 不会被继承优先级, 回到自己设置的值
+    child_thread->nice = child_thread->normal_nice;
+    child_thread->weight = nice_to_weight(child_thread->nice);
+    child_thread->policy = child_thread->normal_policy;
+    child_thread->rt_priority = child_thread->normal_rt_priority;
     child_thread->all_list_tag.prev = child_thread->all_list_tag.next = NULL;
+    // 子进程只有调用fork的这一个线程, 进程的资源要从主线程复制
+    struct task_struct* leader = parent_thread->group_leader;
+    child_thread->userprog_vaddr = leader->userprog_vaddr;
+    memcpy(child_thread->fd_table, leader->fd_table,
+           sizeof(child_thread->fd_table));
+    child_thread->cwd_inode_nr = leader->cwd_inode_nr;
+    child_thread->group_leader = child_thread;
+    child_thread->nr_threads = 1;
+    child_thread->joiner = NULL;
+    child_thread->io_ring = NULL;  // 环的worker属于父进程, 不继承
+    child_thread->exit_task = NULL;
+    list_init(&child_thread->child_waiters);
     block_desc_init(child_thread->u_block_desc);
+    if (fpu_copy(child_thread, parent_thread) == -1) { return -1; }
     // 复制父进程的虚拟地址池的位图
-    uint32_t bitmap_pg_cnt =
-        DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8, PG_SIZE);
-    void* vaddr_btmp = get_kernel_pages(bitmap_pg_cnt);
-    if (vaddr_btmp == NULL) return -1;
+    void* vaddr_btmp = get_kernel_pages(VADDR_BITMAP_PG_CNT);
+    if (vaddr_btmp == NULL) {
+        fpu_release(child_thread);
+        return -1;
+    }
     /* 此时child_thread->userprog_vaddr.vaddr_bitmap.bits还是指向父进程虚拟地址的位图地址
     * 下面将child_thread->userprog_vaddr.vaddr_bitmap.bits指向自己的位图vaddr_btmp */
     memcpy(vaddr_btmp, child_thread->userprog_vaddr.vaddr_bitmap.bits,
-           bitmap_pg_cnt * PG_SIZE);
+           VADDR_BITMAP_PG_CNT * PG_SIZE);
     child_thread->userprog_vaddr.vaddr_bitmap.bits = vaddr_btmp;
     strcat(child_thread->name, "_fork");
     return 0;
@@ -41,10 +74,10 @@ static int32_t copy_pcb_vaddrbitmap_stack0(struct task_struct* child_thread,
 static void copy_body_stack3(struct task_struct* child_thread,
                              struct task_struct* parent_thread,
                              void* buf_page) {
-    uint8_t* vaddr_btmp = parent_thread->userprog_vaddr.vaddr_bitmap.bits;
-    uint32_t btmp_bytes_len =
-        parent_thread->userprog_vaddr.vaddr_bitmap.btmp_bytes_len;
-    uint32_t vaddr_start = parent_thread->userprog_vaddr.vaddr_start;
+    struct virtual_addr* uvaddr = &parent_thread->group_leader->userprog_vaddr;
+    uint8_t* vaddr_btmp = uvaddr->vaddr_bitmap.bits;
+    uint32_t btmp_bytes_len = uvaddr->vaddr_bitmap.btmp_bytes_len;
+    uint32_t vaddr_start = uvaddr->vaddr_start;
     uint32_t idx_byte = 0;
     uint32_t idx_bit = 0;
     uint32_t prog_vaddr = 0;
@@ -54,9 +87,10 @@ static void copy_body_stack3(struct task_struct* child_thread,
         if (vaddr_btmp[idx_byte]) {
             idx_bit = 0;
             while (idx_bit < 8) {
-                if ((BITMAP_MASK << idx_bit) & vaddr_btmp[idx_byte]) {
-                    prog_vaddr =
-                        (idx_byte * 8 + idx_bit) * PG_SIZE + vaddr_start;
+                prog_vaddr = (idx_byte * 8 + idx_bit) * PG_SIZE + vaddr_start;
+                // vdso页已由create_page_dir映射好, 不复制
+                if (((BITMAP_MASK << idx_bit) & vaddr_btmp[idx_byte]) &&
+                    !vdso_page(prog_vaddr)) {
                     memcpy(buf_page, (void*)prog_vaddr, PG_SIZE);
                     page_dir_activate(child_thread);
                     get_a_page_without_opvaddrbitmap(PF_USER, prog_vaddr);
@@ -107,13 +141,13 @@ static int32_t build_child_stack(struct task_struct* child_thread) {
     return 0;
 }
 
-/* 更新inode打开数 */
-static void update_inode_open_cnts(struct task_struct* thread) {
+/* 子进程与父进程共用全局文件表中的项, 增加它们的引用数 */
+static void update_file_refs(struct task_struct* thread) {
     int32_t local_fd = 3, global_fd = 0;
     while (local_fd < MAX_FILES_OPEN_PER_PROC) {
         global_fd = thread->fd_table[local_fd];
         ASSERT(global_fd < MAX_FILE_OPEN);
-        if (global_fd != -1) { file_table[global_fd].fd_inode->i_open_cnts++; }
+        if (global_fd != -1) { file_table[global_fd].fd_refs++; }
         local_fd++;
     }
 }
@@ -127,12 +161,24 @@ static int32_t copy_process(struct task_struct* child_thread,
 
     /* a 复制父进程的pcb、虚拟地址位图、内核栈到子进程 */
     if (copy_pcb_vaddrbitmap_stack0(child_thread, parent_thread) == -1) {
+        mfree_page(PF_KERNEL, buf_page, 1);
         return -1;
     }
 
     /* b 为子进程创建页表,此页表仅包括内核空间 */
     child_thread->pgdir = create_page_dir();
-    if (child_thread->pgdir == NULL) { return -1; }
+    if (child_thread->pgdir == NULL) {
+        mfree_page(PF_KERNEL, child_thread->userprog_vaddr.vaddr_bitmap.bits,
+                   VADDR_BITMAP_PG_CNT);
+        fpu_release(child_thread);
+        mfree_page(PF_KERNEL, buf_page, 1);
+        return -1;
+    }
+
+    // 后面不会再失败, 这时才分配pid并加入哈希表. 失败的fork不占pid,
+    // pid2thread也找不到没有运行过的pcb
+    child_thread->pid = fork_pid(child_thread);
+    vdso_set_proc(child_thread);
 
     /* c 复制父进程进程体及用户栈给子进程 */
     copy_body_stack3(child_thread, parent_thread, buf_page);
@@ -141,7 +187,7 @@ static int32_t copy_process(struct task_struct* child_thread,
     build_child_stack(child_thread);
 
     /* e 更新文件inode的打开数 */
-    update_inode_open_cnts(child_thread);
+    update_file_refs(child_thread);
 
     mfree_page(PF_KERNEL, buf_page, 1);
     return 0;
@@ -150,16 +196,18 @@ static int32_t copy_process(struct task_struct* child_thread,
 /* fork子进程, 内核线程不可直接调用 */
 pid_t sys_fork() {
     struct task_struct* parent_thread = running_thread();
-    struct task_struct* child_thread = get_kernel_pages(1);
+    struct task_struct* child_thread = pcb_alloc();
     if (child_thread == NULL) { return -1; }
     ASSERT(INTR_OFF == intr_get_status() && parent_thread->pgdir != NULL);
 
-    if (copy_process(child_thread, parent_thread) == -1) { return -1; }
+    if (copy_process(child_thread, parent_thread) == -1) {
+        pcb_free(child_thread);
+        return -1;
+    }
 
     /* 添加到就绪线程队列和所有线程队列,子进程由调试器安排运行 */
-    ASSERT(!elem_find(&thread_ready_list, &child_thread->general_tag));
-    list_append(&thread_ready_list, &child_thread->general_tag);
-    ASSERT(!elem_find(&thread_all_list, &child_thread->all_list_tag));
+    sched_enqueue(child_thread);
+    ASSERT(!elem_linked(&child_thread->all_list_tag));
     list_append(&thread_all_list, &child_thread->all_list_tag);
 
     return child_thread->pid;  // 父进程返回子进程的pid
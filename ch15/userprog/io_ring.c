@@ -0,0 +1,213 @@
+#include "io_ring.h"
+#include "clone.h"
+#include "debug.h"
+#include "fs.h"
+#include "global.h"
+#include "interrupt.h"
+#include "list.h"
+#include "memory.h"
+#include "sched.h"
+#include "string.h"
+#include "sync.h"
+#include "thread.h"
+
+// 内核私有的部分. 共享页中的长度和指针可能被用户改掉, 以这里的为准
+struct io_ring_ctx {
+    struct io_ring* ring;      // 共享页, 在进程的用户空间中
+    struct io_sqe* sqes;
+    struct io_cqe* cqes;
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    struct task_struct* worker;
+    struct lock lock;          // 保护下面几项
+    struct condition sq_cond;  // worker在这里等待新的提交
+    struct condition cq_cond;  // io_ring_enter在这里等待完成
+    bool busy;                 // worker正在执行请求
+    bool exiting;
+};
+
+// 还没被用户取走的完成项个数
+static uint32_t io_ring_cq_pending(struct io_ring_ctx* ctx) {
+    return ctx->ring->cq_tail - ctx->ring->cq_head;
+}
+
+// 有请求要处理, 并且完成队列还放得下
+static bool io_ring_ready(struct io_ring_ctx* ctx) {
+    return ctx->ring->sq_head != ctx->ring->sq_tail &&
+           io_ring_cq_pending(ctx) < ctx->cq_entries;
+}
+
+static int32_t io_ring_exec(const struct io_sqe* sqe) {
+    switch (sqe->opcode) {
+        case IORING_OP_NOP: return 0;
+        case IORING_OP_READ: return sys_read(sqe->fd, sqe->buf, sqe->len);
+        case IORING_OP_WRITE: return sys_write(sqe->fd, sqe->buf, sqe->len);
+        case IORING_OP_OPEN: return sys_open(sqe->buf, sqe->len);
+        case IORING_OP_CLOSE: return sys_close(sqe->fd);
+        case IORING_OP_FSYNC: return sys_fsync(sqe->fd);
+        default: return -1;
+    }
+}
+
+// 执行提交队列中的请求, 直到队列空了或者完成队列满了
+static void io_ring_drain(struct io_ring_ctx* ctx) {
+    struct io_ring* ring = ctx->ring;
+    while (io_ring_ready(ctx)) {
+        // 先拷出来, 执行期间用户可能改写队列项
+        struct io_sqe sqe = ctx->sqes[ring->sq_head & (ctx->sq_entries - 1)];
+        ring->sq_head++;
+        int32_t res = io_ring_exec(&sqe);
+
+        struct io_cqe* cqe = &ctx->cqes[ring->cq_tail & (ctx->cq_entries - 1)];
+        cqe->user_data = sqe.user_data;
+        cqe->res = res;
+        asm volatile("" : : : "memory");  // 完成项写好后才能让用户看到
+        ring->cq_tail++;
+
+        lock_acquire(&ctx->lock);
+        cond_broadcast(&ctx->cq_cond);
+        lock_release(&ctx->lock);
+    }
+}
+
+// worker线程属于提交请求的进程, 共享它的页表和文件描述符, 可以直接访问用户缓冲区
+static void io_ring_worker(void* arg) {
+    struct io_ring_ctx* ctx = arg;
+    while (true) {
+        lock_acquire(&ctx->lock);
+        while (!ctx->exiting && !io_ring_ready(ctx)) {
+            cond_wait(&ctx->sq_cond, &ctx->lock);
+        }
+        if (ctx->exiting) {
+            lock_release(&ctx->lock);
+            break;
+        }
+        ctx->busy = true;
+        lock_release(&ctx->lock);
+
+        io_ring_drain(ctx);
+
+        lock_acquire(&ctx->lock);
+        ctx->busy = false;
+        cond_broadcast(&ctx->cq_cond);
+        lock_release(&ctx->lock);
+    }
+    sys_thread_exit(0);
+}
+
+// 在当前进程中创建worker, 与clone出的线程一样计入进程的线程数
+static struct task_struct* io_ring_worker_start(struct io_ring_ctx* ctx) {
+    struct task_struct* cur = running_thread();
+    struct task_struct* leader = cur->group_leader;
+    struct task_struct* worker = pcb_alloc();
+    if (worker == NULL) { return NULL; }
+    init_thread(worker, "io_ring", cur->priority);
+    worker->pgdir = leader->pgdir;
+    worker->group_leader = leader;
+    worker->parent_pid = leader->parent_pid;
+    thread_create(worker, io_ring_worker, ctx);
+
+    enum intr_status old_status = intr_disable();
+    leader->nr_threads++;
+    ASSERT(!elem_linked(&worker->all_list_tag));
+    list_append(&thread_all_list, &worker->all_list_tag);
+    sched_enqueue(worker);
+    intr_set_status(old_status);
+    return worker;
+}
+
+// 为当前进程建立提交队列长度为entries的环, 返回共享页在用户空间的地址.
+// 每个进程只能有一个环, 失败返回NULL
+struct io_ring* sys_io_ring_setup(uint32_t entries) {
+    struct task_struct* cur = running_thread();
+    struct task_struct* leader = cur->group_leader;
+    if (cur->pgdir == NULL || leader->io_ring != NULL) { return NULL; }
+    if (entries == 0 || entries > IO_RING_MAX_ENTRIES ||
+        (entries & (entries - 1)) != 0) {
+        return NULL;
+    }
+
+    struct io_ring_ctx* ctx = get_kernel_pages(1);
+    if (ctx == NULL) { return NULL; }
+    struct io_ring* ring = get_user_pages(1);
+    if (ring == NULL) {
+        mfree_page(PF_KERNEL, ctx, 1);
+        return NULL;
+    }
+    ctx->ring = ring;
+    ctx->sq_entries = entries;
+    ctx->cq_entries = entries * 2;
+    ctx->sqes = (struct io_sqe*)(ring + 1);
+    ctx->cqes = (struct io_cqe*)(ctx->sqes + ctx->sq_entries);
+    lock_init(&ctx->lock);
+    cond_init(&ctx->sq_cond);
+    cond_init(&ctx->cq_cond);
+    ctx->busy = false;
+    ctx->exiting = false;
+
+    ring->sq_entries = ctx->sq_entries;
+    ring->cq_entries = ctx->cq_entries;
+    ring->sqes = ctx->sqes;
+    ring->cqes = ctx->cqes;
+
+    ctx->worker = io_ring_worker_start(ctx);
+    if (ctx->worker == NULL) {
+        mfree_page(PF_USER, ring, 1);
+        mfree_page(PF_KERNEL, ctx, 1);
+        return NULL;
+    }
+    leader->io_ring = ctx;
+    return ring;
+}
+
+// 通知worker处理新提交的请求, 并等到至少有min_complete个完成项.
+// 所有请求都处理完或者完成队列满了也会返回. 返回可取的完成项个数, 失败返回-1
+int32_t sys_io_ring_enter(uint32_t min_complete) {
+    struct io_ring_ctx* ctx = running_thread()->group_leader->io_ring;
+    if (ctx == NULL || min_complete > ctx->cq_entries) { return -1; }
+    lock_acquire(&ctx->lock);
+    cond_signal(&ctx->sq_cond);
+    while (!ctx->exiting && io_ring_cq_pending(ctx) < min_complete &&
+           (ctx->busy || io_ring_ready(ctx))) {
+        cond_wait(&ctx->cq_cond, &ctx->lock);
+    }
+    int32_t ret = io_ring_cq_pending(ctx);
+    lock_release(&ctx->lock);
+    return ret;
+}
+
+// 通知worker退出, 并让在io_ring_enter中等待的线程返回
+static void io_ring_stop(struct io_ring_ctx* ctx) {
+    lock_acquire(&ctx->lock);
+    ctx->exiting = true;
+    cond_signal(&ctx->sq_cond);
+    cond_broadcast(&ctx->cq_cond);
+    lock_release(&ctx->lock);
+}
+
+// 结束worker并释放环. 调用者要保证进程中没有别的线程还在使用它
+int32_t sys_io_ring_destroy() {
+    struct task_struct* leader = running_thread()->group_leader;
+    struct io_ring_ctx* ctx = leader->io_ring;
+    if (ctx == NULL) { return -1; }
+    io_ring_stop(ctx);
+    // worker正在执行的请求做完才会退出
+    sys_thread_join(ctx->worker->pid, NULL);
+    leader->io_ring = NULL;
+    mfree_page(PF_USER, ctx->ring, 1);
+    mfree_page(PF_KERNEL, ctx, 1);
+    return 0;
+}
+
+// 进程退出的第一步, 让worker和等待完成的线程都结束, 它们计入进程的线程数
+void io_ring_exit(struct task_struct* leader) {
+    if (leader->io_ring != NULL) { io_ring_stop(leader->io_ring); }
+}
+
+// 进程退出时其他线程都已结束, 只需释放内核私有部分.
+// 共享页和其他用户页一起由进程退出时释放, worker的pcb由wait回收
+void io_ring_release(struct task_struct* leader) {
+    if (leader->io_ring == NULL) { return; }
+    mfree_page(PF_KERNEL, leader->io_ring, 1);
+    leader->io_ring = NULL;
+}
@@ -0,0 +1,54 @@
+#ifndef __USERPROG_IO_RING_H
+#define __USERPROG_IO_RING_H
+
+#include "stdint.h"
+
+#define IO_RING_MAX_ENTRIES 64  // 提交队列和完成队列要放进一页
+
+enum io_ring_op {
+    IORING_OP_NOP,
+    IORING_OP_READ,
+    IORING_OP_WRITE,
+    IORING_OP_OPEN,
+    IORING_OP_CLOSE,
+    IORING_OP_FSYNC
+};
+
+// 提交队列项
+struct io_sqe {
+    uint32_t opcode;     // enum io_ring_op
+    int32_t fd;
+    void* buf;           // read/write的缓冲区, open的路径名
+    uint32_t len;        // read/write的字节数, open的flag
+    uint32_t user_data;  // 原样带回到完成队列项中
+};
+
+// 完成队列项
+struct io_cqe {
+    uint32_t user_data;
+    int32_t res;  // 对应系统调用的返回值
+};
+
+// 用户态和内核共享的一页, 开头是这个头部, 后面依次是提交队列和完成队列.
+// 提交队列用户推进tail, 内核推进head; 完成队列内核推进tail, 用户推进head.
+// 下标一直递增, 用时与队列长度取模
+struct io_ring {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    uint32_t sq_entries;  // 2的幂
+    uint32_t cq_entries;  // 提交队列的两倍
+    struct io_sqe* sqes;
+    struct io_cqe* cqes;
+};
+
+struct task_struct;
+
+struct io_ring* sys_io_ring_setup(uint32_t entries);
+int32_t sys_io_ring_enter(uint32_t min_complete);
+int32_t sys_io_ring_destroy(void);
+void io_ring_exit(struct task_struct* leader);
+void io_ring_release(struct task_struct* leader);
+
+#endif
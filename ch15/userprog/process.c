@@ -8,6 +8,8 @@
 #include "interrupt.h"
 #include "string.h"
 #include "console.h"
+#include "sched.h"
+#include "vdso.h"
 
 extern void intr_exit(); // kernel.S中定义的函数
 
@@ -53,12 +55,14 @@ void process_activate(struct task_struct* p_thread) {
 
     if (p_thread->pgdir) {
         update_tss_esp(p_thread);
+        update_tls_desc(p_thread);
     }
 }
 
 // 创建页目录表, 返回页目录的虚拟地址, 失败返回-1
 uint32_t* create_page_dir() {
-    uint32_t* page_dir_vaddr = get_kernel_pages(1);
+    // 页目录后面紧跟着vdso的页表和进程私有页
+    uint32_t* page_dir_vaddr = get_kernel_pages(PGDIR_PAGES);
     if (page_dir_vaddr == NULL) {
         console_put_char("create_page_dir: get_kernel_page failed!");
         return NULL;
@@ -74,6 +78,7 @@ uint32_t* create_page_dir() {
     uint32_t new_page_dir_phy_addr = addr_v2p((uint32_t)page_dir_vaddr);
     // 最后一个页目录项记录用户进程自己的页目录表的物理地址.
     page_dir_vaddr[1023] = new_page_dir_phy_addr | PG_US_U | PG_RW_W | PG_P_1;
+    vdso_map(page_dir_vaddr);
     return page_dir_vaddr;
 }
 
@@ -84,23 +89,26 @@ void create_user_vaddr_bitmap(struct task_struct* user_prog) {
     user_prog->userprog_vaddr.vaddr_bitmap.bits = get_kernel_pages(bitmap_pg_cnt); // 从内核空间申请page, 用来存储bitmap
     user_prog->userprog_vaddr.vaddr_bitmap.btmp_bytes_len = (0xc0000000 - USER_VADDR_START) / PG_SIZE / 8;
     bitmap_init(&user_prog->userprog_vaddr.vaddr_bitmap);
+    // vdso的两页不能再分配出去
+    bitmap_set(&user_prog->userprog_vaddr.vaddr_bitmap, (VDSO_CLOCK_VADDR - USER_VADDR_START) / PG_SIZE, 1);
+    bitmap_set(&user_prog->userprog_vaddr.vaddr_bitmap, (VDSO_PROC_VADDR - USER_VADDR_START) / PG_SIZE, 1);
 }
 
 // 创建用户进程
 void process_execute(void* filename, char* name) {
-    struct task_struct* thread = get_kernel_pages(1); // pcb占一个page
+    struct task_struct* thread = pcb_alloc(); // pcb占一个page
     init_thread(thread, name, default_prio);
     create_user_vaddr_bitmap(thread);
     thread_create(thread, start_process, filename);
     thread->pgdir = create_page_dir();
+    vdso_set_proc(thread);
     block_desc_init(thread->u_block_desc);
 
     // 添加到内核的 thread list, 包括 ready list 和 all list
     enum intr_status old_status = intr_disable();
-    ASSERT(!elem_find(&thread_ready_list, &thread->general_tag));
-    list_append(&thread_ready_list, &thread->general_tag);
+    sched_enqueue(thread);
 
-    ASSERT(!elem_find(&thread_all_list, &thread->all_list_tag));
+    ASSERT(!elem_linked(&thread->all_list_tag));
     list_append(&thread_all_list, &thread->all_list_tag);
     intr_set_status(old_status);
 }
@@ -1,21 +1,43 @@
 #include "syscall-init.h"
+#include "clone.h"
 #include "console.h"
+#include "cpu.h"
 #include "fork.h"
 #include "fs.h"
+#include "futex.h"
+#include "ide.h"
+#include "io_ring.h"
 #include "memory.h"
 #include "print.h"
+#include "sched.h"
 #include "stdint.h"
 #include "string.h"
 #include "syscall.h"
 #include "thread.h"
+#include "timer.h"
+#include "tsc.h"
+#include "wait_exit.h"
 
-#define syscall_nr 32
+#define syscall_nr 64
 
 typedef void* syscall;
 syscall syscall_table[syscall_nr];
+bool sysenter_enabled;  // 是否开启了sysenter快速系统调用
 
+extern void sysenter_entry(void);
+
+// 返回进程的pid, 也就是主线程的pid
 uint32_t sys_getpid() {
-    return running_thread()->pid;
+    return running_thread()->group_leader->pid;
+}
+
+// 设置sysenter的入口. 内核栈顶随任务切换在update_tss_esp中更新
+static void sysenter_init() {
+    sysenter_enabled = sysenter_supported();
+    if (!sysenter_enabled) { return; }
+    wrmsr(MSR_SYSENTER_CS, SELECTOR_SYSENTER_CS);
+    wrmsr(MSR_SYSENTER_ESP, 0);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
 }
 
 void syscall_init() {
@@ -42,5 +64,26 @@ void syscall_init() {
     syscall_table[SYS_REWINDDIR] = sys_rewinddir;
     syscall_table[SYS_STAT] = sys_stat;
     syscall_table[SYS_PS] = sys_ps;
+    syscall_table[SYS_SETPRIORITY] = sys_setpriority;
+    syscall_table[SYS_GETPRIORITY] = sys_getpriority;
+    syscall_table[SYS_SCHED_SETSCHEDULER] = sys_sched_setscheduler;
+    syscall_table[SYS_SCHED_GETSCHEDULER] = sys_sched_getscheduler;
+    syscall_table[SYS_NANOSLEEP] = sys_nanosleep;
+    syscall_table[SYS_CLOCK_GETTIME] = sys_clock_gettime;
+    syscall_table[SYS_PI_BENCH] = sys_pi_bench;
+    syscall_table[SYS_FUTEX] = sys_futex;
+    syscall_table[SYS_CLONE] = sys_clone;
+    syscall_table[SYS_THREAD_EXIT] = sys_thread_exit;
+    syscall_table[SYS_THREAD_JOIN] = sys_thread_join;
+    syscall_table[SYS_IO_RING_SETUP] = sys_io_ring_setup;
+    syscall_table[SYS_IO_RING_ENTER] = sys_io_ring_enter;
+    syscall_table[SYS_IO_RING_DESTROY] = sys_io_ring_destroy;
+    syscall_table[SYS_EXIT] = sys_exit;
+    syscall_table[SYS_WAIT] = sys_wait;
+    syscall_table[SYS_GETSTATS] = sys_getstats;
+    syscall_table[SYS_IDE_BENCH] = sys_ide_bench;
+    syscall_table[SYS_IDE_CHECK] = sys_ide_check;
+    sysenter_init();
+    put_str(sysenter_enabled ? "   sysenter: yes\n" : "   sysenter: no\n");
     put_str("syscall_init done\n");
 }
@@ -1,8 +1,11 @@
 #ifndef __USERPROG_SYSCALLINIT_H
 #define __USERPROG_SYSCALLINIT_H
 
+#include "global.h"
 #include "stdint.h"
 
+extern bool sysenter_enabled;
+
 void syscall_init();
 uint32_t sys_getpid();
 
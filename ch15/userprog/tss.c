@@ -3,6 +3,8 @@
 #include "global.h"
 #include "string.h"
 #include "print.h"
+#include "cpu.h"
+#include "syscall-init.h"
 
 // 参考图11-4. 
 // TSS里面基本都是寄存器, 表示他们的状态
@@ -47,6 +49,10 @@ static struct tss tss;
 void update_tss_esp(struct task_struct* pthread) {
     // pthread指向pcb, pcb再往上一页就是内核栈
     tss.esp0 = (uint32_t*)((uint32_t)pthread + PG_SIZE);
+    // sysenter不经过tss, 内核栈顶要单独写到msr中
+    if (sysenter_enabled) {
+        wrmsr(MSR_SYSENTER_ESP, (uint32_t)pthread + PG_SIZE);
+    }
 }
 
 static struct gdt_desc make_gdt_desc(uint32_t* desc_addr, uint32_t limit, uint8_t attr_low, uint8_t attr_high) {
@@ -61,6 +67,16 @@ static struct gdt_desc make_gdt_desc(uint32_t* desc_addr, uint32_t limit, uint8_
     return desc;
 }
 
+// 把TLS段的基址改为pthread->tls. 返回用户态时intr_exit会重新加载gs, 新基址随之生效
+void update_tls_desc(struct task_struct* pthread) {
+    *((struct gdt_desc*)0xc0000938) = make_gdt_desc(
+        (uint32_t*)pthread->tls,
+        0xfffff,
+        GDT_DATA_ATTR_LOW_DPL3,
+        GDT_ATTR_HIGH
+    );
+}
+
 // 再gdt中创建tss, 并重新加载gdt
 void tss_init() {
     put_str("tss_init start\n");
@@ -88,7 +104,38 @@ void tss_init() {
         GDT_DATA_ATTR_LOW_DPL3,
         GDT_ATTR_HIGH
     );
-    uint64_t gdt_operand = ((8 * 7 - 1) | ((uint64_t)(uint32_t)0xc0000900) << 16);
+    *((struct gdt_desc*)0xc0000938) = make_gdt_desc(
+        (uint32_t*)0,
+        0xfffff,
+        GDT_DATA_ATTR_LOW_DPL3,
+        GDT_ATTR_HIGH
+    );
+    // sysenter/sysexit用的四个平坦段
+    *((struct gdt_desc*)0xc0000940) = make_gdt_desc(
+        (uint32_t*)0,
+        0xfffff,
+        GDT_CODE_ATTR_LOW_DPL0,
+        GDT_ATTR_HIGH
+    );
+    *((struct gdt_desc*)0xc0000948) = make_gdt_desc(
+        (uint32_t*)0,
+        0xfffff,
+        GDT_DATA_ATTR_LOW_DPL0,
+        GDT_ATTR_HIGH
+    );
+    *((struct gdt_desc*)0xc0000950) = make_gdt_desc(
+        (uint32_t*)0,
+        0xfffff,
+        GDT_CODE_ATTR_LOW_DPL3,
+        GDT_ATTR_HIGH
+    );
+    *((struct gdt_desc*)0xc0000958) = make_gdt_desc(
+        (uint32_t*)0,
+        0xfffff,
+        GDT_DATA_ATTR_LOW_DPL3,
+        GDT_ATTR_HIGH
+    );
+    uint64_t gdt_operand = ((12 * 8 - 1) | ((uint64_t)(uint32_t)0xc0000900) << 16);
     asm volatile ("lgdt %0" : : "m" (gdt_operand));
     asm volatile ("ltr %w0" : : "r" (SELECTOR_TSS));
     put_str("tss_init and ltr done\n");
@@ -4,6 +4,7 @@
 #include "thread.h"
 
 void update_tss_esp(struct task_struct* pthread);
+void update_tls_desc(struct task_struct* pthread);
 void tss_init();
 
 #endif
\ No newline at end of file
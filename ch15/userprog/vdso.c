@@ -0,0 +1,70 @@
+#include "vdso.h"
+#include "debug.h"
+#include "memory.h"
+#include "print.h"
+#include "string.h"
+#include "timer.h"
+#include "tsc.h"
+
+static struct vdso_clock* vdso_clock;  // 时钟页的内核虚拟地址
+
+// pgdir之后的两页分别是映射vdso的页表和进程私有页, 见create_page_dir
+static uint32_t* vdso_page_table(uint32_t* pgdir) {
+    return (uint32_t*)((uint32_t)pgdir + PG_SIZE);
+}
+
+static struct vdso_proc* vdso_proc_page(uint32_t* pgdir) {
+    return (struct vdso_proc*)((uint32_t)pgdir + 2 * PG_SIZE);
+}
+
+// 在新进程的页目录中把vdso两页只读映射到用户空间. 用户栈也在这张页表中
+void vdso_map(uint32_t* pgdir) {
+    uint32_t* pt = vdso_page_table(pgdir);
+    memset(pt, 0, PG_SIZE);
+    memset(vdso_proc_page(pgdir), 0, PG_SIZE);
+    pgdir[VDSO_CLOCK_VADDR >> 22] =
+        addr_v2p((uint32_t)pt) | PG_US_U | PG_RW_W | PG_P_1;
+    pt[(VDSO_CLOCK_VADDR >> 12) & 0x3ff] =
+        addr_v2p((uint32_t)vdso_clock) | PG_US_U | PG_RW_R | PG_P_1;
+    pt[(VDSO_PROC_VADDR >> 12) & 0x3ff] =
+        addr_v2p((uint32_t)vdso_proc_page(pgdir)) | PG_US_U | PG_RW_R |
+        PG_P_1;
+}
+
+// 进程的pid确定后填写私有页
+void vdso_set_proc(struct task_struct* pthread) {
+    ASSERT(pthread->pgdir != NULL);
+    struct vdso_proc* proc = vdso_proc_page(pthread->pgdir);
+    proc->pid = pthread->pid;
+    proc->ppid = pthread->parent_pid;
+}
+
+// vaddr是否是vdso的页. 它们在虚拟地址位图中占了位, 但不属于进程自己
+bool vdso_page(uint32_t vaddr) {
+    return vaddr == VDSO_CLOCK_VADDR || vaddr == VDSO_PROC_VADDR;
+}
+
+uint64_t vdso_coarse_ns() {
+    return vdso_clock->tick_ns;
+}
+
+// 时钟中断中调用
+void vdso_update() {
+    vdso_clock->seq++;
+    asm volatile("" : : : "memory");
+    vdso_clock->ticks = ticks;
+    vdso_clock->tick_ns = ktime_get();
+    vdso_clock->tsc_boot = tsc_boot;
+    vdso_clock->tsc_mult = tsc_mult;
+    vdso_clock->tsc_shift = tsc_shift;
+    asm volatile("" : : : "memory");
+    vdso_clock->seq++;
+}
+
+// 要在创建第一个用户进程之前调用
+void vdso_init() {
+    put_str("vdso_init start\n");
+    vdso_clock = get_kernel_pages(1);
+    if (vdso_clock == NULL) { PANIC("vdso_init: alloc clock page failed"); }
+    put_str("vdso_init done\n");
+}
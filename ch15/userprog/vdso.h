@@ -0,0 +1,39 @@
+#ifndef __USERPROG_VDSO_H
+#define __USERPROG_VDSO_H
+
+#include "global.h"
+#include "stdint.h"
+#include "thread.h"
+
+// 映射在每个进程用户栈下面的两页, 用户态只读. 读它们不用进内核
+#define VDSO_CLOCK_VADDR 0xbfffd000  // 所有进程共享的时钟页
+#define VDSO_PROC_VADDR 0xbfffe000   // 进程私有的常量页
+
+// 进程的页目录和vdso所在的页表, 进程私有页连续分配, 一起释放
+#define PGDIR_PAGES 3
+
+// 内核每个tick更新一次. 内核写的时候seq为奇数, 读者看到奇数或者读前读后seq不同要重读
+struct vdso_clock {
+    volatile uint32_t seq;
+    uint32_t ticks;    // 开机以来的tick数
+    uint64_t tick_ns;  // 最近一次tick时的单调时间, 即CLOCK_MONOTONIC_COARSE
+    // 用户态自己读TSC算CLOCK_MONOTONIC, 算法与内核的ktime_get相同
+    uint64_t tsc_boot;
+    uint32_t tsc_mult;
+    uint32_t tsc_shift;
+};
+
+// 进程的常量, 同一进程的线程共享
+struct vdso_proc {
+    pid_t pid;
+    pid_t ppid;
+};
+
+void vdso_map(uint32_t* pgdir);
+void vdso_set_proc(struct task_struct* pthread);
+bool vdso_page(uint32_t vaddr);
+uint64_t vdso_coarse_ns(void);
+void vdso_update(void);
+void vdso_init(void);
+
+#endif
@@ -0,0 +1,184 @@
+#include "wait_exit.h"
+#include "clone.h"
+#include "debug.h"
+#include "fpu.h"
+#include "fs.h"
+#include "futex.h"
+#include "global.h"
+#include "interrupt.h"
+#include "io_ring.h"
+#include "ioqueue.h"
+#include "keyboard.h"
+#include "list.h"
+#include "memory.h"
+#include "process.h"
+#include "thread.h"
+#include "vdso.h"
+
+// 正在退出且还有其他线程的进程数. 不为0时, 中断和系统调用返回用户态之前
+// 要检查当前线程所属的进程是否在退出
+uint32_t group_exits_pending;
+
+// 唤醒在wait中等待leader的子进程退出的线程
+static void wake_child_waiters(struct task_struct* leader) {
+    while (!list_empty(&leader->child_waiters)) {
+        struct list_elem* elem = list_pop(&leader->child_waiters);
+        thread_unblock(elem2entry(struct task_struct, general_tag, elem));
+    }
+}
+
+// pthread所属的进程正在退出, 并且执行exit的不是它自己
+bool group_exiting(struct task_struct* pthread) {
+    struct task_struct* exit_task = pthread->group_leader->exit_task;
+    return exit_task != NULL && exit_task != pthread;
+}
+
+// kernel.S在返回用户态之前调用. 所属进程正在退出的线程在这里结束, 不再回到用户态
+void user_return_check() {
+    if (group_exiting(running_thread())) { thread_die(0); }
+}
+
+// 结束进程中除当前线程以外的线程, 等它们都变成HANGING.
+// 运行和就绪的线程在返回用户态时结束, 睡眠在futex, wait, io_ring和键盘输入上的线程先唤醒
+static void kill_other_threads(struct task_struct* leader) {
+    if (leader->nr_threads == 1) { return; }
+    group_exits_pending++;
+    futex_wake_group(leader);
+    wake_child_waiters(leader);
+    io_ring_exit(leader);
+    ioq_wake_group(&kbd_buf, leader);
+    while (leader->nr_threads > 1) { thread_block(TASK_WAITING); }
+    group_exits_pending--;
+}
+
+// 一次性释放进程的文件和用户空间. 页目录和pcb由父进程在wait中回收
+static void release_prog_resource(struct task_struct* leader) {
+    // fork出的进程共用文件表项, 关闭只是减引用, 最后一个关闭的才关inode
+    int32_t fd;
+    for (fd = 3; fd < MAX_FILES_OPEN_PER_PROC; fd++) {
+        if (leader->fd_table[fd] != -1) { sys_close(fd); }
+    }
+    io_ring_release(leader);
+    // vdso的页表和页目录一起分配
+    release_user_space(VDSO_CLOCK_VADDR >> 22);
+    uint32_t bitmap_pg_cnt =
+        DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8, PG_SIZE);
+    mfree_page(PF_KERNEL, leader->userprog_vaddr.vaddr_bitmap.bits,
+               bitmap_pg_cnt);
+}
+
+// 子进程交给init收养, 其中已经退出的要通知init回收
+static void reparent_children(struct task_struct* leader) {
+    bool has_zombie = false;
+    struct list_elem* elem = thread_all_list.head.next;
+    while (elem != &thread_all_list.tail) {
+        struct task_struct* pthread =
+            elem2entry(struct task_struct, all_list_tag, elem);
+        elem = elem->next;
+        if (pthread != pthread->group_leader ||
+            pthread->parent_pid != leader->pid) {
+            continue;
+        }
+        pthread->parent_pid = INIT_PID;
+        if (pthread->nr_threads == 0) {
+            has_zombie = true;
+        } else {
+            vdso_set_proc(pthread);
+        }
+    }
+    if (has_zombie) { wake_child_waiters(pid2thread(INIT_PID)); }
+}
+
+// 结束当前进程. 进程的其他线程都结束后释放地址空间和文件, 进程变成僵尸,
+// 由父进程在wait中取走退出码并回收. 不会返回
+void sys_exit(int32_t status) {
+    struct task_struct* cur = running_thread();
+    struct task_struct* leader = cur->group_leader;
+    ASSERT(leader->pgdir != NULL);
+    if (leader->pid == INIT_PID) { PANIC("sys_exit: init exited"); }
+    intr_disable();
+    // 别的线程已经在执行exit, 只需结束自己
+    if (leader->exit_task != NULL) { thread_die(0); }
+    leader->exit_task = cur;
+    leader->exit_status = status;
+    kill_other_threads(leader);
+
+    release_prog_resource(leader);
+    fpu_release(cur);
+    reparent_children(leader);
+    leader->nr_threads = 0;  // 资源已经释放完, 可以回收了
+    struct task_struct* parent = pid2thread(leader->parent_pid);
+    if (parent != NULL) { wake_child_waiters(parent); }
+    thread_block(TASK_HANGING);
+    PANIC("sys_exit: a zombie was scheduled");
+}
+
+// 找leader的一个已退出的子进程, 没有时返回NULL. has_child表示还有没有子进程
+static struct task_struct* find_zombie_child(struct task_struct* leader,
+                                             bool* has_child) {
+    *has_child = false;
+    struct list_elem* elem = thread_all_list.head.next;
+    while (elem != &thread_all_list.tail) {
+        struct task_struct* pthread =
+            elem2entry(struct task_struct, all_list_tag, elem);
+        elem = elem->next;
+        if (pthread != pthread->group_leader ||
+            pthread->parent_pid != leader->pid) {
+            continue;
+        }
+        *has_child = true;
+        if (pthread->status == TASK_HANGING && pthread->nr_threads == 0) {
+            return pthread;
+        }
+    }
+    return NULL;
+}
+
+// 回收僵尸进程的页目录和组内所有线程的pcb, 主线程的pcb最后释放
+static void reap_process(struct task_struct* child) {
+    mfree_page(PF_KERNEL, child->pgdir, PGDIR_PAGES);
+    struct list_elem* elem = thread_all_list.head.next;
+    while (elem != &thread_all_list.tail) {
+        struct task_struct* pthread =
+            elem2entry(struct task_struct, all_list_tag, elem);
+        elem = elem->next;
+        if (pthread->group_leader != child || pthread == child) { continue; }
+        ASSERT(pthread->status == TASK_HANGING);
+        list_remove(&pthread->all_list_tag);
+        release_pid(pthread->pid);
+        pcb_free(pthread);
+    }
+    list_remove(&child->all_list_tag);
+    release_pid(child->pid);
+    pcb_free(child);
+}
+
+// 等待任一子进程退出并回收它, 退出码存入status.
+// 返回子进程的pid, 没有子进程或当前进程正在退出时返回-1.
+// init要收养孤儿, 没有子进程时也一直等待
+pid_t sys_wait(int32_t* status) {
+    struct task_struct* cur = running_thread();
+    struct task_struct* leader = cur->group_leader;
+    enum intr_status old_status = intr_disable();
+    struct task_struct* child;
+    while (true) {
+        bool has_child;
+        if (leader->exit_task != NULL) {
+            intr_set_status(old_status);
+            return -1;
+        }
+        child = find_zombie_child(leader, &has_child);
+        if (child != NULL) { break; }
+        if (!has_child && leader->pid != INIT_PID) {
+            intr_set_status(old_status);
+            return -1;
+        }
+        list_append(&leader->child_waiters, &cur->general_tag);
+        thread_block(TASK_WAITING);
+    }
+    pid_t child_pid = child->pid;
+    if (status != NULL) { *status = child->exit_status; }
+    reap_process(child);
+    intr_set_status(old_status);
+    return child_pid;
+}
@@ -0,0 +1,16 @@
+#ifndef __USERPROG_WAIT_EXIT_H
+#define __USERPROG_WAIT_EXIT_H
+
+#include "stdint.h"
+#include "thread.h"
+
+#define INIT_PID 1  // init进程, 收养父进程先退出的子进程
+
+extern uint32_t group_exits_pending;
+
+bool group_exiting(struct task_struct* pthread);
+void user_return_check(void);
+void sys_exit(int32_t status);
+pid_t sys_wait(int32_t* status);
+
+#endif